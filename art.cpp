@@ -0,0 +1,929 @@
+#include <assert.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "art.h"
+
+enum
+{
+    ART_NODE4 = 1,
+    ART_NODE16 = 2,
+    ART_NODE48 = 3,
+    ART_NODE256 = 4,
+};
+
+struct ArtNode4
+{
+    ArtNode hdr;
+    uint8_t keys[4] = {}; // sorted
+    void *children[4] = {};
+};
+
+struct ArtNode16
+{
+    ArtNode hdr;
+    uint8_t keys[16] = {}; // sorted
+    void *children[16] = {};
+};
+
+struct ArtNode48
+{
+    ArtNode hdr;
+    uint8_t index[256] = {}; // 1-based position in `children`, 0 is empty
+    void *children[48] = {};
+};
+
+struct ArtNode256
+{
+    ArtNode hdr;
+    void *children[256] = {};
+};
+
+// leaves are values with the lowest bit set
+static bool is_leaf(void *ptr)
+{
+    return (uintptr_t)ptr & 1;
+}
+
+static void *leaf_val(void *ptr)
+{
+    return (void *)((uintptr_t)ptr & ~(uintptr_t)1);
+}
+
+static void *make_leaf(void *val)
+{
+    assert(((uintptr_t)val & 1) == 0);
+    return (void *)((uintptr_t)val | 1);
+}
+
+static size_t min_size(size_t a, size_t b)
+{
+    return a < b ? a : b;
+}
+
+static bool key_eq(ArtTree *tree, void *val, const uint8_t *key, size_t len)
+{
+    const uint8_t *k2 = NULL;
+    size_t len2 = 0;
+    tree->key_of(val, &k2, &len2);
+
+    return len == len2 && 0 == memcmp(key, k2, len);
+}
+
+static ArtNode *node_new(uint8_t type)
+{
+    ArtNode *node = NULL;
+
+    switch (type)
+    {
+    case ART_NODE4:
+        node = &(new ArtNode4())->hdr;
+        break;
+    case ART_NODE16:
+        node = &(new ArtNode16())->hdr;
+        break;
+    case ART_NODE48:
+        node = &(new ArtNode48())->hdr;
+        break;
+    default:
+        node = &(new ArtNode256())->hdr;
+        break;
+    }
+
+    node->type = type;
+
+    return node;
+}
+
+static void node_free(ArtNode *node)
+{
+    switch (node->type)
+    {
+    case ART_NODE4:
+        delete (ArtNode4 *)node;
+        break;
+    case ART_NODE16:
+        delete (ArtNode16 *)node;
+        break;
+    case ART_NODE48:
+        delete (ArtNode48 *)node;
+        break;
+    default:
+        delete (ArtNode256 *)node;
+        break;
+    }
+}
+
+// position of the byte in a Node16, or -1
+static int node16_find(ArtNode16 *n, uint8_t byte)
+{
+#ifdef __SSE2__
+    __m128i cmp = _mm_cmpeq_epi8(_mm_set1_epi8((char)byte),
+                                 _mm_loadu_si128((const __m128i *)n->keys));
+    int mask = _mm_movemask_epi8(cmp) & ((1 << n->hdr.n_children) - 1);
+
+    return mask ? __builtin_ctz(mask) : -1;
+#else
+    for (int i = 0; i < n->hdr.n_children; ++i)
+    {
+        if (n->keys[i] == byte)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+#endif
+}
+
+// number of keys less than the byte in a sorted key array
+static int keys_lower_bound(const uint8_t *keys, int n, uint8_t byte)
+{
+#ifdef __SSE2__
+    if (n > 4)
+    {
+        // unsigned compare by flipping the sign bits
+        __m128i flip = _mm_set1_epi8((char)0x80);
+        __m128i cmp = _mm_cmplt_epi8(
+            _mm_xor_si128(_mm_loadu_si128((const __m128i *)keys), flip),
+            _mm_xor_si128(_mm_set1_epi8((char)byte), flip));
+        int mask = _mm_movemask_epi8(cmp) & ((1 << n) - 1);
+
+        return __builtin_popcount(mask);
+    }
+#endif
+
+    int i = 0;
+    while (i < n && keys[i] < byte)
+    {
+        i++;
+    }
+
+    return i;
+}
+
+// the address of the child slot for the byte, or NULL
+static void **find_child(ArtNode *node, uint8_t byte)
+{
+    switch (node->type)
+    {
+    case ART_NODE4:
+    {
+        ArtNode4 *n = (ArtNode4 *)node;
+        for (int i = 0; i < node->n_children; ++i)
+        {
+            if (n->keys[i] == byte)
+            {
+                return &n->children[i];
+            }
+        }
+        return NULL;
+    }
+    case ART_NODE16:
+    {
+        ArtNode16 *n = (ArtNode16 *)node;
+        int i = node16_find(n, byte);
+        return i < 0 ? NULL : &n->children[i];
+    }
+    case ART_NODE48:
+    {
+        ArtNode48 *n = (ArtNode48 *)node;
+        return n->index[byte] ? &n->children[n->index[byte] - 1] : NULL;
+    }
+    default:
+    {
+        ArtNode256 *n = (ArtNode256 *)node;
+        return n->children[byte] ? &n->children[byte] : NULL;
+    }
+    }
+}
+
+// visit the children in byte order until `f` returns false
+static bool for_each_child(ArtNode *node, bool (*f)(uint8_t byte, void *child, void *arg), void *arg)
+{
+    switch (node->type)
+    {
+    case ART_NODE4:
+    {
+        ArtNode4 *n = (ArtNode4 *)node;
+        for (int i = 0; i < node->n_children; ++i)
+        {
+            if (!f(n->keys[i], n->children[i], arg))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+    case ART_NODE16:
+    {
+        ArtNode16 *n = (ArtNode16 *)node;
+        for (int i = 0; i < node->n_children; ++i)
+        {
+            if (!f(n->keys[i], n->children[i], arg))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+    case ART_NODE48:
+    {
+        ArtNode48 *n = (ArtNode48 *)node;
+        for (int b = 0; b < 256; ++b)
+        {
+            if (n->index[b] && !f((uint8_t)b, n->children[n->index[b] - 1], arg))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+    default:
+    {
+        ArtNode256 *n = (ArtNode256 *)node;
+        for (int b = 0; b < 256; ++b)
+        {
+            if (n->children[b] && !f((uint8_t)b, n->children[b], arg))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+    }
+}
+
+// any value in the subtree, they all share the prefix of the node
+static void *any_val(void *ptr)
+{
+    while (!is_leaf(ptr))
+    {
+        ArtNode *node = (ArtNode *)ptr;
+
+        if (node->term)
+        {
+            return node->term;
+        }
+
+        switch (node->type)
+        {
+        case ART_NODE4:
+            ptr = ((ArtNode4 *)node)->children[0];
+            break;
+        case ART_NODE16:
+            ptr = ((ArtNode16 *)node)->children[0];
+            break;
+        case ART_NODE48:
+        {
+            ArtNode48 *n = (ArtNode48 *)node;
+            int b = 0;
+            while (!n->index[b])
+            {
+                b++;
+            }
+            ptr = n->children[n->index[b] - 1];
+            break;
+        }
+        default:
+        {
+            ArtNode256 *n = (ArtNode256 *)node;
+            int b = 0;
+            while (!n->children[b])
+            {
+                b++;
+            }
+            ptr = n->children[b];
+            break;
+        }
+        }
+    }
+
+    return leaf_val(ptr);
+}
+
+// the full prefix of a node starting at `depth`
+static const uint8_t *node_prefix(ArtTree *tree, ArtNode *node, size_t depth)
+{
+    if (node->prefix_len <= k_art_max_prefix)
+    {
+        return node->prefix;
+    }
+
+    const uint8_t *key = NULL;
+    size_t len = 0;
+    tree->key_of(any_val(node), &key, &len);
+
+    return key + depth;
+}
+
+// length of the common part of the node prefix and the key
+static size_t prefix_mismatch(ArtTree *tree, ArtNode *node,
+                              const uint8_t *key, size_t len, size_t depth)
+{
+    const uint8_t *prefix = node_prefix(tree, node, depth);
+    size_t max = min_size(node->prefix_len, len - depth);
+
+    size_t i = 0;
+    while (i < max && prefix[i] == key[depth + i])
+    {
+        i++;
+    }
+
+    return i;
+}
+
+static void add_child(void **ref, ArtNode *node, uint8_t byte, void *child);
+
+// copy the header and children into a bigger or smaller node
+static ArtNode *node_resize(ArtNode *node, uint8_t type)
+{
+    ArtNode *other = node_new(type);
+    ArtNode saved = *node;
+    saved.type = type;
+    saved.n_children = 0;
+    *other = saved;
+
+    struct Ctx
+    {
+        ArtNode *node;
+    } ctx = {other};
+
+    (void)for_each_child(node, [](uint8_t byte, void *child, void *arg) -> bool {
+        ArtNode *dst = ((Ctx *)arg)->node;
+        void *ref = dst;
+        add_child(&ref, dst, byte, child);
+        assert(ref == dst);
+        return true;
+    }, &ctx);
+
+    node_free(node);
+
+    return other;
+}
+
+// insert into sorted arrays of keys and children
+static void sorted_insert(uint8_t *keys, void **children, int n, uint8_t byte, void *child)
+{
+    int pos = keys_lower_bound(keys, n, byte);
+
+    memmove(keys + pos + 1, keys + pos, n - pos);
+    memmove(children + pos + 1, children + pos, (n - pos) * sizeof(void *));
+    keys[pos] = byte;
+    children[pos] = child;
+}
+
+// `*ref` is replaced if the node has to grow
+static void add_child(void **ref, ArtNode *node, uint8_t byte, void *child)
+{
+    switch (node->type)
+    {
+    case ART_NODE4:
+    {
+        if (node->n_children == 4)
+        {
+            node = node_resize(node, ART_NODE16);
+            *ref = node;
+            return add_child(ref, node, byte, child);
+        }
+        ArtNode4 *n = (ArtNode4 *)node;
+        sorted_insert(n->keys, n->children, node->n_children, byte, child);
+        break;
+    }
+    case ART_NODE16:
+    {
+        if (node->n_children == 16)
+        {
+            node = node_resize(node, ART_NODE48);
+            *ref = node;
+            return add_child(ref, node, byte, child);
+        }
+        ArtNode16 *n = (ArtNode16 *)node;
+        sorted_insert(n->keys, n->children, node->n_children, byte, child);
+        break;
+    }
+    case ART_NODE48:
+    {
+        if (node->n_children == 48)
+        {
+            node = node_resize(node, ART_NODE256);
+            *ref = node;
+            return add_child(ref, node, byte, child);
+        }
+        ArtNode48 *n = (ArtNode48 *)node;
+        int pos = 0;
+        while (n->children[pos])
+        {
+            pos++;
+        }
+        n->children[pos] = child;
+        n->index[byte] = (uint8_t)(pos + 1);
+        break;
+    }
+    default:
+        ((ArtNode256 *)node)->children[byte] = child;
+        break;
+    }
+
+    node->n_children++;
+}
+
+static void remove_child(ArtNode *node, uint8_t byte)
+{
+    switch (node->type)
+    {
+    case ART_NODE4:
+    case ART_NODE16:
+    {
+        uint8_t *keys = node->type == ART_NODE4 ? ((ArtNode4 *)node)->keys : ((ArtNode16 *)node)->keys;
+        void **children = node->type == ART_NODE4 ? ((ArtNode4 *)node)->children : ((ArtNode16 *)node)->children;
+        int n = node->n_children;
+        int pos = keys_lower_bound(keys, n, byte);
+        assert(pos < n && keys[pos] == byte);
+
+        memmove(keys + pos, keys + pos + 1, n - pos - 1);
+        memmove(children + pos, children + pos + 1, (n - pos - 1) * sizeof(void *));
+        children[n - 1] = NULL;
+        break;
+    }
+    case ART_NODE48:
+    {
+        ArtNode48 *n = (ArtNode48 *)node;
+        n->children[n->index[byte] - 1] = NULL;
+        n->index[byte] = 0;
+        break;
+    }
+    default:
+        ((ArtNode256 *)node)->children[byte] = NULL;
+        break;
+    }
+
+    node->n_children--;
+}
+
+// shrink or collapse the node after a removal, `*ref` points to it
+static void node_shrink(void **ref, ArtNode *node)
+{
+    switch (node->type)
+    {
+    case ART_NODE4:
+        if (node->n_children == 0)
+        {
+            // only the terminal value is left
+            *ref = node->term ? make_leaf(node->term) : NULL;
+            node_free(node);
+        }
+        else if (node->n_children == 1 && !node->term)
+        {
+            // merge with the only child
+            ArtNode4 *n = (ArtNode4 *)node;
+            void *child = n->children[0];
+
+            if (!is_leaf(child))
+            {
+                ArtNode *c = (ArtNode *)child;
+                uint8_t buf[k_art_max_prefix];
+                size_t len = min_size(node->prefix_len, k_art_max_prefix);
+
+                memcpy(buf, node->prefix, len);
+                if (len < k_art_max_prefix)
+                {
+                    buf[len++] = n->keys[0];
+                }
+                size_t rest = min_size(c->prefix_len, k_art_max_prefix - len);
+                memcpy(buf + len, c->prefix, rest);
+
+                c->prefix_len += node->prefix_len + 1;
+                memcpy(c->prefix, buf, min_size(c->prefix_len, k_art_max_prefix));
+            }
+
+            *ref = child;
+            node_free(node);
+        }
+        break;
+    case ART_NODE16:
+        if (node->n_children < 3)
+        {
+            *ref = node_resize(node, ART_NODE4);
+        }
+        break;
+    case ART_NODE48:
+        if (node->n_children < 12)
+        {
+            *ref = node_resize(node, ART_NODE16);
+        }
+        break;
+    default:
+        if (node->n_children < 37)
+        {
+            *ref = node_resize(node, ART_NODE48);
+        }
+        break;
+    }
+}
+
+void *art_lookup(ArtTree *tree, const uint8_t *key, size_t len)
+{
+    void *ptr = tree->root;
+    size_t depth = 0;
+
+    while (ptr)
+    {
+        if (is_leaf(ptr))
+        {
+            void *val = leaf_val(ptr);
+            return key_eq(tree, val, key, len) ? val : NULL;
+        }
+
+        ArtNode *node = (ArtNode *)ptr;
+
+        // optimistic, only the stored part of the prefix is checked,
+        // the final key compare catches the rest
+        size_t stored = min_size(node->prefix_len, k_art_max_prefix);
+        if (depth + node->prefix_len > len ||
+            0 != memcmp(node->prefix, key + depth, stored))
+        {
+            return NULL;
+        }
+
+        depth += node->prefix_len;
+
+        if (depth == len)
+        {
+            void *val = node->term;
+            return val && key_eq(tree, val, key, len) ? val : NULL;
+        }
+
+        void **slot = find_child(node, key[depth]);
+        ptr = slot ? *slot : NULL;
+        depth++;
+    }
+
+    return NULL;
+}
+
+// a new Node4 with the leaf and the new value below a common prefix
+static ArtNode *split_leaf(ArtTree *tree, void *leaf, const uint8_t *key, size_t len,
+                           size_t depth, void *val)
+{
+    void *old = leaf_val(leaf);
+    const uint8_t *k2 = NULL;
+    size_t len2 = 0;
+    tree->key_of(old, &k2, &len2);
+
+    size_t lcp = 0;
+    size_t max = min_size(len, len2) - depth;
+    while (lcp < max && key[depth + lcp] == k2[depth + lcp])
+    {
+        lcp++;
+    }
+
+    ArtNode *node = node_new(ART_NODE4);
+    node->prefix_len = (uint32_t)lcp;
+    memcpy(node->prefix, key + depth, min_size(lcp, k_art_max_prefix));
+    depth += lcp;
+
+    void *ref = node;
+    if (depth == len2)
+    {
+        node->term = old;
+    }
+    else
+    {
+        add_child(&ref, node, k2[depth], leaf);
+    }
+
+    if (depth == len)
+    {
+        node->term = val;
+    }
+    else
+    {
+        add_child(&ref, node, key[depth], make_leaf(val));
+    }
+
+    return node;
+}
+
+// a new Node4 above the node, where the key leaves its prefix
+static ArtNode *split_prefix(ArtTree *tree, ArtNode *node, size_t p,
+                             const uint8_t *key, size_t len, size_t depth, void *val)
+{
+    const uint8_t *prefix = node_prefix(tree, node, depth);
+
+    ArtNode *parent = node_new(ART_NODE4);
+    parent->prefix_len = (uint32_t)p;
+    memcpy(parent->prefix, prefix, min_size(p, k_art_max_prefix));
+
+    // the node keeps what is after the branching byte
+    uint8_t byte = prefix[p];
+    node->prefix_len -= (uint32_t)(p + 1);
+    memmove(node->prefix, prefix + p + 1, min_size(node->prefix_len, k_art_max_prefix));
+
+    void *ref = parent;
+    add_child(&ref, parent, byte, node);
+
+    if (depth + p == len)
+    {
+        parent->term = val;
+    }
+    else
+    {
+        add_child(&ref, parent, key[depth + p], make_leaf(val));
+    }
+
+    return parent;
+}
+
+static void *insert_rec(ArtTree *tree, void **ref, const uint8_t *key, size_t len,
+                        size_t depth, void *val)
+{
+    void *ptr = *ref;
+
+    if (!ptr)
+    {
+        *ref = make_leaf(val);
+        tree->size++;
+        return NULL;
+    }
+
+    if (is_leaf(ptr))
+    {
+        if (key_eq(tree, leaf_val(ptr), key, len))
+        {
+            *ref = make_leaf(val);
+            return leaf_val(ptr);
+        }
+
+        *ref = split_leaf(tree, ptr, key, len, depth, val);
+        tree->size++;
+        return NULL;
+    }
+
+    ArtNode *node = (ArtNode *)ptr;
+
+    if (node->prefix_len)
+    {
+        size_t p = prefix_mismatch(tree, node, key, len, depth);
+
+        if (p < node->prefix_len)
+        {
+            *ref = split_prefix(tree, node, p, key, len, depth, val);
+            tree->size++;
+            return NULL;
+        }
+
+        depth += node->prefix_len;
+    }
+
+    if (depth == len)
+    {
+        void *old = node->term;
+        node->term = val;
+        tree->size += old ? 0 : 1;
+        return old;
+    }
+
+    if (void **slot = find_child(node, key[depth]))
+    {
+        return insert_rec(tree, slot, key, len, depth + 1, val);
+    }
+
+    add_child(ref, node, key[depth], make_leaf(val));
+    tree->size++;
+
+    return NULL;
+}
+
+void *art_insert(ArtTree *tree, const uint8_t *key, size_t len, void *val)
+{
+    return insert_rec(tree, &tree->root, key, len, 0, val);
+}
+
+static void *pop_rec(ArtTree *tree, void **ref, const uint8_t *key, size_t len, size_t depth)
+{
+    void *ptr = *ref;
+
+    if (!ptr)
+    {
+        return NULL;
+    }
+
+    if (is_leaf(ptr))
+    {
+        void *val = leaf_val(ptr);
+
+        if (!key_eq(tree, val, key, len))
+        {
+            return NULL;
+        }
+
+        *ref = NULL;
+        return val;
+    }
+
+    ArtNode *node = (ArtNode *)ptr;
+
+    if (node->prefix_len)
+    {
+        if (prefix_mismatch(tree, node, key, len, depth) < node->prefix_len)
+        {
+            return NULL;
+        }
+
+        depth += node->prefix_len;
+    }
+
+    void *val = NULL;
+
+    if (depth == len)
+    {
+        val = node->term;
+        node->term = NULL;
+    }
+    else if (void **slot = find_child(node, key[depth]))
+    {
+        void *child = *slot;
+
+        if (is_leaf(child))
+        {
+            if (key_eq(tree, leaf_val(child), key, len))
+            {
+                val = leaf_val(child);
+                remove_child(node, key[depth]);
+            }
+        }
+        else
+        {
+            val = pop_rec(tree, slot, key, len, depth + 1);
+        }
+    }
+
+    if (val)
+    {
+        node_shrink(ref, node);
+    }
+
+    return val;
+}
+
+void *art_pop(ArtTree *tree, const uint8_t *key, size_t len)
+{
+    void *val = pop_rec(tree, &tree->root, key, len, 0);
+
+    if (val)
+    {
+        tree->size--;
+    }
+
+    return val;
+}
+
+struct IterCtx
+{
+    ArtTree *tree;
+    const uint8_t *start;
+    size_t len;
+    bool (*f)(void *val, void *arg);
+    void *arg;
+    size_t depth; // for children visited by `iter_from`
+};
+
+static bool iter_all(void *ptr, IterCtx *ctx);
+
+static bool iter_all_child(uint8_t byte, void *child, void *arg)
+{
+    (void)byte;
+    return iter_all(child, (IterCtx *)arg);
+}
+
+// everything below in key order, the terminal value is the shortest key
+static bool iter_all(void *ptr, IterCtx *ctx)
+{
+    if (is_leaf(ptr))
+    {
+        return ctx->f(leaf_val(ptr), ctx->arg);
+    }
+
+    ArtNode *node = (ArtNode *)ptr;
+
+    if (node->term && !ctx->f(node->term, ctx->arg))
+    {
+        return false;
+    }
+
+    return for_each_child(node, &iter_all_child, ctx);
+}
+
+static bool iter_from(void *ptr, size_t depth, IterCtx *ctx);
+
+static bool iter_from_child(uint8_t byte, void *child, void *arg)
+{
+    IterCtx *ctx = (IterCtx *)arg;
+    uint8_t bound = ctx->start[ctx->depth];
+
+    if (byte < bound)
+    {
+        return true;
+    }
+
+    if (byte > bound)
+    {
+        return iter_all(child, ctx);
+    }
+
+    size_t depth = ctx->depth;
+    bool ok = iter_from(child, depth + 1, ctx);
+    ctx->depth = depth;
+
+    return ok;
+}
+
+// keys below share `start[0, depth)`, skip those less than `start`
+static bool iter_from(void *ptr, size_t depth, IterCtx *ctx)
+{
+    if (is_leaf(ptr))
+    {
+        const uint8_t *key = NULL;
+        size_t len = 0;
+        ctx->tree->key_of(leaf_val(ptr), &key, &len);
+
+        int cmp = memcmp(key, ctx->start, min_size(len, ctx->len));
+        if (cmp < 0 || (cmp == 0 && len < ctx->len))
+        {
+            return true;
+        }
+
+        return ctx->f(leaf_val(ptr), ctx->arg);
+    }
+
+    ArtNode *node = (ArtNode *)ptr;
+    const uint8_t *prefix = node_prefix(ctx->tree, node, depth);
+
+    for (size_t i = 0; i < node->prefix_len; ++i)
+    {
+        if (depth + i == ctx->len || prefix[i] > ctx->start[depth + i])
+        {
+            return iter_all(ptr, ctx); // all greater
+        }
+
+        if (prefix[i] < ctx->start[depth + i])
+        {
+            return true; // all less
+        }
+    }
+
+    depth += node->prefix_len;
+
+    if (depth == ctx->len)
+    {
+        return iter_all(ptr, ctx);
+    }
+
+    // the terminal key is a proper prefix of `start`, so it's less
+    ctx->depth = depth;
+
+    return for_each_child(node, &iter_from_child, ctx);
+}
+
+void art_iter_from(ArtTree *tree, const uint8_t *start, size_t len,
+                   bool (*f)(void *val, void *arg), void *arg)
+{
+    if (!tree->root)
+    {
+        return;
+    }
+
+    IterCtx ctx = {tree, start, len, f, arg, 0};
+    (void)iter_from(tree->root, 0, &ctx);
+}
+
+static void destroy_rec(void *ptr);
+
+static bool destroy_child(uint8_t byte, void *child, void *arg)
+{
+    (void)byte;
+    (void)arg;
+    destroy_rec(child);
+    return true;
+}
+
+static void destroy_rec(void *ptr)
+{
+    if (!ptr || is_leaf(ptr))
+    {
+        return;
+    }
+
+    ArtNode *node = (ArtNode *)ptr;
+    (void)for_each_child(node, &destroy_child, NULL);
+    node_free(node);
+}
+
+void art_destroy(ArtTree *tree)
+{
+    destroy_rec(tree->root);
+    tree->root = NULL;
+    tree->size = 0;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Adaptive radix tree, an ordered keyspace.
+//
+// Inner nodes grow and shrink between 4, 16, 48 and 256 children, and
+// chains of single-child nodes are compressed into a prefix. Leaves are
+// the values themselves, tagged in the child pointer, and the key of a
+// value is read back through `key_of`, so keys are not copied.
+
+const size_t k_art_max_prefix = 10; // longer prefixes are checked at the leaf
+
+struct ArtNode
+{
+    uint8_t type = 0;
+    uint16_t n_children = 0;
+    uint32_t prefix_len = 0; // only the first `k_art_max_prefix` bytes are stored
+    uint8_t prefix[k_art_max_prefix] = {};
+    void *term = NULL; // the value whose key ends at this node
+};
+
+struct ArtTree
+{
+    void *root = NULL; // a node, or a tagged leaf
+    size_t size = 0;
+    void (*key_of)(void *val, const uint8_t **key, size_t *len) = NULL;
+};
+
+void *art_lookup(ArtTree *tree, const uint8_t *key, size_t len);
+
+// returns the replaced value, if any
+void *art_insert(ArtTree *tree, const uint8_t *key, size_t len, void *val);
+
+void *art_pop(ArtTree *tree, const uint8_t *key, size_t len);
+
+// Visit the values in key order, starting from the first key >= `start`,
+// until `f` returns false.
+void art_iter_from(ArtTree *tree, const uint8_t *start, size_t len,
+                   bool (*f)(void *val, void *arg), void *arg);
+
+// frees the nodes, the values are owned by the caller
+void art_destroy(ArtTree *tree);
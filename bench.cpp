@@ -0,0 +1,1139 @@
+// Compile w/ [g++ -Wall -Wextra -O2 -g -pthread bench.cpp keyspace.cpp hashtable.cpp chashtable.cpp art.cpp hugepage.cpp slab.cpp logstore.cpp evict.cpp tinylfu.cpp epoch.cpp -o bench]
+//
+// Micro benchmarks for the keyspace data structures.
+// Usage: ./bench [--hugepages] [n_keys] [slab|log|hitratio|lookup|concurrent|backends ...]
+//
+// Run it with and without `--hugepages` to compare the TLB effect;
+// the dataset size is roughly n_keys * 150 bytes.
+//
+// `./bench [n_conns] idleconns`, `./bench [n_reqs] pipeline` and
+// `./bench [n_reqs] fairness` measure a running server on port 1234
+// instead, they only run when named. The fairness bench also uses the
+// admin port 1235 if the server listens on it.
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <math.h>
+#include <arpa/inet.h>
+#include <netinet/ip.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <new>
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "hashtable.h"
+#include "chashtable.h"
+#include "epoch.h"
+#include "hugepage.h"
+#include "keyspace.h"
+#include "slab.h"
+#include "logstore.h"
+#include "evict.h"
+#include "tinylfu.h"
+
+#define container_of(ptr, type, member) ({                  \
+    const typeof( ((type *)0)->member ) *__m_ptr = (ptr);    \
+    (type *)( (char *)__m_ptr - offsetof(type, member) ); })
+
+static HPPool g_entry_pool;
+
+static Entry *entry_new()
+{
+    void *ptr = hp_enabled() ? hp_pool_alloc(&g_entry_pool)
+                             : slab_alloc(sizeof(Entry));
+    assert(ptr);
+
+    return new (ptr) Entry();
+}
+
+static void entry_del(Entry *ent)
+{
+    ent->~Entry();
+
+    if (hp_enabled())
+    {
+        hp_pool_free(&g_entry_pool, ent);
+    }
+    else
+    {
+        slab_free(ent, sizeof(Entry));
+    }
+}
+
+static bool entry_eq(HNode *lhs, HNode *rhs)
+{
+    struct Entry *le = container_of(lhs, struct Entry, node);
+    struct Entry *re = container_of(rhs, struct Entry, node);
+
+    return le->key == re->key;
+}
+
+static uint64_t get_monotonic_usec()
+{
+    timespec tv = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+
+    return uint64_t(tv.tv_sec) * 1000000 + tv.tv_nsec / 1000;
+}
+
+static void report(const char *name, size_t n_ops, uint64_t usec)
+{
+    printf("%-28s %10zu ops %8.1f ns/op\n",
+           name, n_ops, (double)usec * 1000 / (double)n_ops);
+}
+
+// random lookups through the C-style API vs the templated one
+static void bench_lookup(size_t n_keys)
+{
+    EntryMap db = {};
+    std::vector<std::string> keys(n_keys);
+
+    for (size_t i = 0; i < n_keys; ++i)
+    {
+        keys[i] = "user:" + std::to_string(i * 7919) + ":session";
+
+        Entry *ent = entry_new();
+        ent->key = keys[i];
+        ent->node.h_code = str_hash((uint8_t *)keys[i].data(), keys[i].size());
+        db.insert(ent);
+    }
+
+    // shuffle the lookup order
+    srand(1);
+    for (size_t i = n_keys - 1; i > 0; --i)
+    {
+        std::swap(keys[i], keys[(size_t)rand() % (i + 1)]);
+    }
+
+    // finish the progressive resizing before timing
+    while (db.map.h2.tab)
+    {
+        hm_help_resizing(&db.map);
+    }
+
+    // the C-style API needs a dummy payload as the key
+    std::vector<Entry> probes(n_keys);
+    for (size_t i = 0; i < n_keys; ++i)
+    {
+        probes[i].key = keys[i];
+    }
+
+    size_t found = 0;
+    uint64_t start = get_monotonic_usec();
+
+    for (Entry &key : probes)
+    {
+        key.node.h_code = str_hash((uint8_t *)key.key.data(), key.key.size());
+
+        found += hm_lookup(&db.map, &key.node, &entry_eq) != NULL;
+    }
+
+    report("hm_lookup (fn pointer)", n_keys, get_monotonic_usec() - start);
+
+    start = get_monotonic_usec();
+
+    for (const std::string &k : keys)
+    {
+        uint64_t h_code = str_hash((uint8_t *)k.data(), k.size());
+
+        found += db.lookup(k, h_code) != NULL;
+    }
+
+    report("THMap::lookup (inlined)", n_keys, get_monotonic_usec() - start);
+
+    assert(found == 2 * n_keys);
+
+    printf("%-28s %10zu bytes\n", "huge page backed", hp_backed_bytes());
+
+    for (const std::string &k : keys)
+    {
+        entry_del(db.pop(k, str_hash((uint8_t *)k.data(), k.size())));
+    }
+
+    db.destroy();
+}
+
+struct CEntry
+{
+    struct CHNode node;
+    std::string key;
+};
+
+static bool centry_eq(CHNode *lhs, CHNode *rhs)
+{
+    return container_of(lhs, CEntry, node)->key == container_of(rhs, CEntry, node)->key;
+}
+
+static CEntry *centry_new(const std::string &key)
+{
+    CEntry *ent = new CEntry();
+    ent->key = key;
+    ent->node.h_code = str_hash((uint8_t *)key.data(), key.size());
+
+    return ent;
+}
+
+static void centry_free(void *ptr)
+{
+    delete (CEntry *)ptr;
+}
+
+// lock-free readers of a shared map while a writer keeps resizing it
+static void bench_concurrent(size_t n_keys, size_t n_readers)
+{
+    CHMap db;
+    chm_init(&db, &epoch_retire);
+
+    for (size_t i = 0; i < n_keys; ++i)
+    {
+        (void)chm_insert(&db, &centry_new("key:" + std::to_string(i))->node, &centry_eq);
+    }
+
+    std::atomic<bool> stop{false};
+    std::atomic<size_t> n_reads{0};
+    std::atomic<size_t> n_misses{0};
+    std::vector<std::thread> threads;
+
+    for (size_t t = 0; t < n_readers; ++t)
+    {
+        threads.emplace_back([&, t]() {
+            size_t i = t * 7919, n = 0, missed = 0;
+            CEntry key;
+
+            while (!stop.load(std::memory_order_relaxed))
+            {
+                key.key = "key:" + std::to_string(i++ % n_keys);
+                key.node.h_code = str_hash((uint8_t *)key.key.data(), key.key.size());
+
+                epoch_enter();
+                missed += chm_lookup(&db, &key.node, &centry_eq) == NULL;
+                epoch_exit();
+                n++;
+            }
+
+            epoch_thread_exit();
+            n_reads += n;
+            n_misses += missed;
+        });
+    }
+
+    // the writer adds new keys, which resizes the map, and removes them
+    std::vector<std::string> added;
+    uint64_t start = get_monotonic_usec();
+
+    for (size_t i = 0; get_monotonic_usec() - start < 1000000; ++i)
+    {
+        std::string k = "new:" + std::to_string(i);
+        (void)chm_insert(&db, &centry_new(k)->node, &centry_eq);
+
+        if (i % 2 == 0)
+        {
+            added.push_back(k);
+        }
+        else
+        {
+            CEntry key;
+            key.key = k;
+            key.node.h_code = str_hash((uint8_t *)k.data(), k.size());
+
+            // readers may still be on the node
+            CHNode *node = chm_pop(&db, &key.node, &centry_eq);
+            epoch_retire(container_of(node, CEntry, node), &centry_free);
+        }
+    }
+
+    stop = true;
+    for (std::thread &th : threads)
+    {
+        th.join();
+    }
+
+    uint64_t usec = get_monotonic_usec() - start;
+    char name[64];
+    snprintf(name, sizeof(name), "chm_lookup (%zu readers)", n_readers);
+    report(name, n_reads, usec * n_readers);
+    assert(n_misses == 0);
+
+    EpochStats epoch;
+    epoch_stats(&epoch);
+    printf("%-28s %10zu retired %zu freed %zu backlog\n", "epoch reclamation",
+           (size_t)epoch.n_retired, (size_t)epoch.n_freed, epoch.backlog);
+
+    // drain the remaining keys
+    for (size_t i = 0; i < n_keys; ++i)
+    {
+        added.push_back("key:" + std::to_string(i));
+    }
+
+    for (const std::string &k : added)
+    {
+        CEntry key;
+        key.key = k;
+        key.node.h_code = str_hash((uint8_t *)key.key.data(), key.key.size());
+        delete container_of(chm_pop(&db, &key.node, &centry_eq), CEntry, node);
+    }
+
+    while (epoch_collect() > 0)
+    {
+    }
+
+    chm_destroy(&db);
+}
+
+static uint64_t get_monotonic_nsec()
+{
+    timespec tv = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+
+    return uint64_t(tv.tv_sec) * 1000000000 + tv.tv_nsec;
+}
+
+static size_t get_rss_bytes()
+{
+    long pages = 0, rss = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+
+    if (fp)
+    {
+        if (2 != fscanf(fp, "%ld %ld", &pages, &rss))
+        {
+            rss = 0;
+        }
+        fclose(fp);
+    }
+
+    return (size_t)rss * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+// the same workload on every keyspace backend:
+// load the keys, then 90% GET and 10% SET overwrites in random order
+static void bench_backends(size_t n_keys)
+{
+    const char *names[] = {"map", "hmap", "slots", "art"};
+
+    std::vector<std::string> keys(n_keys);
+    for (size_t i = 0; i < n_keys; ++i)
+    {
+        // long shared prefixes, like our session keys
+        keys[i] = "user:" + std::to_string(i * 7919 % 1000003) + ":session:" + std::to_string(i);
+    }
+
+    std::vector<uint32_t> lat(n_keys);
+
+    printf("%-8s %12s %10s %10s %10s %12s %12s\n",
+           "backend", "load ops/s", "ops/s", "p50 ns", "p99 ns", "RSS delta", "heap delta");
+
+    // each backend in a child of its own, otherwise it would reuse the
+    // memory freed by the previous one and not show up in the RSS
+    for (const char *name : names)
+    {
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            printf("backends: fork() failed\n");
+            return;
+        }
+
+        if (pid > 0)
+        {
+            waitpid(pid, NULL, 0);
+            continue;
+        }
+
+        size_t rss = get_rss_bytes();
+        size_t heap = mallinfo2().uordblks;
+        Keyspace *ks = ks_new(name);
+
+        uint64_t start = get_monotonic_nsec();
+        for (const std::string &k : keys)
+        {
+            Entry *ent = entry_new();
+            ent->key = k;
+            ent->value = "v";
+            ks_insert(ks, ent);
+        }
+        uint64_t load_ns = get_monotonic_nsec() - start;
+
+        size_t rss_delta = get_rss_bytes() - rss;
+        size_t heap_delta = mallinfo2().uordblks - heap;
+
+        srand(1);
+        start = get_monotonic_nsec();
+        for (size_t i = 0; i < n_keys; ++i)
+        {
+            const std::string &k = keys[(size_t)rand() % n_keys];
+            uint64_t t0 = get_monotonic_nsec();
+
+            Entry *ent = ks_lookup(ks, k);
+            assert(ent);
+            if (i % 10 == 0)
+            {
+                ent->value = "w";
+            }
+
+            lat[i] = (uint32_t)(get_monotonic_nsec() - t0);
+        }
+        uint64_t run_ns = get_monotonic_nsec() - start;
+
+        std::sort(lat.begin(), lat.end());
+        printf("%-8s %12.0f %10.0f %10u %10u %12zu %12zu\n", name,
+               (double)n_keys * 1e9 / (double)load_ns,
+               (double)n_keys * 1e9 / (double)run_ns,
+               lat[n_keys / 2], lat[n_keys * 99 / 100], rss_delta, heap_delta);
+
+        fflush(stdout);
+        _exit(0);
+    }
+}
+
+static const size_t k_obj_sizes[] = {sizeof(Entry), 24, 40, 100};
+const size_t k_n_obj_sizes = sizeof(k_obj_sizes) / sizeof(k_obj_sizes[0]);
+
+// allocate and free batches of small objects
+static void alloc_loop(bool slab, size_t n_ops)
+{
+    const size_t batch = 1024;
+    std::vector<void *> ptrs(batch);
+
+    for (size_t done = 0; done < n_ops; done += batch)
+    {
+        for (size_t i = 0; i < batch; ++i)
+        {
+            size_t size = k_obj_sizes[i % k_n_obj_sizes];
+            ptrs[i] = slab ? slab_alloc(size) : malloc(size);
+        }
+
+        for (size_t i = 0; i < batch; ++i)
+        {
+            size_t j = (i * 7) % batch; // not in allocation order
+            size_t size = k_obj_sizes[j % k_n_obj_sizes];
+
+            if (slab)
+            {
+                slab_free(ptrs[j], size);
+            }
+            else
+            {
+                free(ptrs[j]);
+            }
+        }
+    }
+}
+
+// malloc vs. the slabs, the cost per operation and the memory per key
+static void bench_slab(size_t n_keys)
+{
+    // an Entry with a 24 byte value, the slabs go first on a clean heap
+    for (bool slab : {true, false})
+    {
+        std::vector<void *> ptrs(2 * n_keys);
+        size_t rss = get_rss_bytes();
+
+        for (size_t i = 0; i < n_keys; ++i)
+        {
+            ptrs[2 * i] = slab ? slab_alloc(sizeof(Entry)) : malloc(sizeof(Entry));
+            ptrs[2 * i + 1] = slab ? slab_alloc(24) : malloc(24);
+            memset(ptrs[2 * i], 0, sizeof(Entry));
+            memset(ptrs[2 * i + 1], 0, 24);
+        }
+
+        printf("%-8s %6.1f bytes/key (%zu + 24 live)\n", slab ? "slab" : "malloc",
+               (double)(get_rss_bytes() - rss) / n_keys, sizeof(Entry));
+
+        for (size_t i = 0; i < 2 * n_keys; ++i)
+        {
+            if (slab)
+            {
+                slab_free(ptrs[i], i % 2 ? 24 : sizeof(Entry));
+            }
+            else
+            {
+                free(ptrs[i]);
+            }
+        }
+    }
+
+    for (size_t n_threads = 1; n_threads <= 4; n_threads *= 2)
+    {
+        for (bool slab : {false, true})
+        {
+            std::vector<std::thread> threads;
+            uint64_t start = get_monotonic_usec();
+
+            for (size_t t = 0; t < n_threads; ++t)
+            {
+                threads.emplace_back([&]() { alloc_loop(slab, n_keys); });
+            }
+
+            for (std::thread &th : threads)
+            {
+                th.join();
+            }
+
+            std::string name = std::string(slab ? "slab" : "malloc") +
+                               " x" + std::to_string(n_threads);
+            report(name.c_str(), 2 * n_keys * n_threads, get_monotonic_usec() - start);
+        }
+    }
+}
+
+// overwrites of random sizes, values in slab strings vs in the log
+static void bench_log(size_t n_keys)
+{
+    const size_t n_ops = 5 * n_keys;
+    std::string data(512, 'x');
+
+    std::vector<SlabString> strs(n_keys);
+    std::vector<LogRec *> recs(n_keys);
+
+    for (bool log : {false, true})
+    {
+        srand(1);
+        uint64_t start = get_monotonic_usec();
+        uint64_t clean_usec = 0;
+
+        for (size_t i = 0; i < n_ops; ++i)
+        {
+            size_t k = (size_t)rand() % n_keys;
+            size_t len = 16 + (size_t)rand() % 496;
+
+            if (!log)
+            {
+                // a new buffer, like a SET overwrite in the server
+                SlabString val(data.data(), len);
+                strs[k].swap(val);
+                continue;
+            }
+
+            LogRec *rec = log_append(data.data(), len, &recs[k]);
+            if (recs[k])
+            {
+                log_free(recs[k]);
+            }
+            recs[k] = rec;
+
+            // like the server, which cleans once per event loop iteration
+            if (i % 1000 == 0)
+            {
+                uint64_t t0 = get_monotonic_usec();
+                (void)log_clean(0.9, 4);
+                clean_usec += get_monotonic_usec() - t0;
+            }
+        }
+
+        uint64_t usec = get_monotonic_usec() - start;
+        report(log ? "log overwrite" : "slab overwrite", n_ops, usec - clean_usec);
+        if (log)
+        {
+            report("log cleaner (amortized)", n_ops, clean_usec);
+        }
+
+        size_t live = 0, mapped = 0;
+        for (size_t k = 0; k < n_keys; ++k)
+        {
+            live += log ? (recs[k] ? recs[k]->len : 0) : strs[k].size();
+        }
+
+        if (log)
+        {
+            LogStats stats;
+            log_stats(&stats);
+            mapped = stats.mapped_bytes;
+        }
+        else
+        {
+            mapped = slab_mapped_bytes();
+        }
+
+        printf("%-28s %10zu data %10zu mapped %5.1f%%\n", "",
+               live, mapped, 100.0 * (double)live / (double)mapped);
+    }
+
+    for (LogRec *rec : recs)
+    {
+        if (rec)
+        {
+            log_free(rec);
+        }
+    }
+}
+
+// key ids with a Zipfian popularity
+static std::vector<uint32_t> zipf_trace(size_t n_items, size_t n_reqs, double skew, std::mt19937_64 &rng)
+{
+    std::vector<double> cdf(n_items);
+    double sum = 0;
+
+    for (size_t i = 0; i < n_items; ++i)
+    {
+        sum += 1.0 / pow((double)(i + 1), skew);
+        cdf[i] = sum;
+    }
+
+    std::uniform_real_distribution<double> uniform(0, sum);
+    std::vector<uint32_t> trace(n_reqs);
+
+    for (uint32_t &id : trace)
+    {
+        id = (uint32_t)(std::upper_bound(cdf.begin(), cdf.end(), uniform(rng)) - cdf.begin());
+    }
+
+    return trace;
+}
+
+static bool cb_collect(Entry *ent, void *arg)
+{
+    ((std::vector<Entry *> *)arg)->push_back(ent);
+    return true;
+}
+
+// a cache of `capacity` keys, returns the hit ratio
+static double simulate_cache(const std::vector<uint32_t> &trace, size_t capacity,
+                             int policy, bool admission)
+{
+    Keyspace *ks = ks_new("hmap");
+    EvictPool pool;
+    TinyLfu tl;
+    tlfu_init(&tl, 8 * capacity);
+
+    size_t n_hits = 0;
+    std::string key;
+
+    for (size_t i = 0; i < trace.size(); ++i)
+    {
+        evict_set_clock(i / 100); // 100 requests per second
+        key = "key:" + std::to_string(trace[i]);
+
+        if (admission)
+        {
+            tlfu_record(&tl, str_hash((uint8_t *)key.data(), key.size()));
+        }
+
+        Entry *ent = ks_lookup(ks, key);
+        if (ent)
+        {
+            n_hits++;
+            evict_touch(ent, policy);
+            continue;
+        }
+
+        // a miss fills the cache
+        ent = entry_new();
+        ent->key = key;
+        evict_init(ent, policy);
+        ks_insert(ks, ent);
+        if (admission)
+        {
+            tlfu_window_push(&tl, ks, key);
+        }
+
+        while (ks_size(ks) > capacity)
+        {
+            std::string victim;
+            Entry *gone = NULL;
+
+            if (admission)
+            {
+                if (tlfu_pick_victim(&tl, ks, &pool, policy, NULL, victim))
+                {
+                    gone = ks_pop(ks, victim);
+                }
+            }
+            else
+            {
+                evict_pool_fill(&pool, ks, policy, NULL);
+                while (!gone && evict_pool_pop(&pool, victim))
+                {
+                    gone = ks_pop(ks, victim);
+                }
+            }
+
+            assert(gone);
+            entry_del(gone);
+        }
+    }
+
+    std::vector<Entry *> ents;
+    ks->ops->for_each(ks, &cb_collect, &ents);
+    for (Entry *ent : ents)
+    {
+        entry_del(ks_pop(ks, ent->key));
+    }
+    ks->ops->destroy(ks);
+
+    return (double)n_hits / (double)trace.size();
+}
+
+// hit ratios of the eviction policies with and without admission
+static void bench_hit_ratio(size_t n_items)
+{
+    std::mt19937_64 rng(1);
+    size_t n_reqs = 10 * n_items;
+
+    std::vector<uint32_t> zipf = zipf_trace(n_items, n_reqs, 0.99, rng);
+
+    // the same popularity, plus bursts of keys that are read only once
+    std::vector<uint32_t> scan;
+    uint32_t next_once = (uint32_t)n_items;
+    for (size_t i = 0; i < zipf.size(); ++i)
+    {
+        scan.push_back(zipf[i]);
+        if (i % 10000 == 9999)
+        {
+            for (size_t j = 0; j < 5000; ++j)
+            {
+                scan.push_back(next_once++);
+            }
+        }
+    }
+
+    struct
+    {
+        const char *name;
+        const std::vector<uint32_t> *trace;
+    } traces[] = {{"zipf 0.99", &zipf}, {"zipf + scans", &scan}};
+
+    printf("%-14s %8s %-12s %10s %10s\n", "trace", "cache", "policy", "plain", "tinylfu");
+
+    for (auto &tr : traces)
+    {
+        for (size_t pct : {1, 10})
+        {
+            size_t capacity = n_items * pct / 100;
+
+            for (int policy : {EVICT_ALLKEYS_LRU, EVICT_ALLKEYS_LFU})
+            {
+                printf("%-14s %7zu%% %-12s %9.2f%% %9.2f%%\n", tr.name, pct,
+                       evict_policy_name(policy),
+                       100 * simulate_cache(*tr.trace, capacity, policy, false),
+                       100 * simulate_cache(*tr.trace, capacity, policy, true));
+            }
+        }
+    }
+}
+
+static int server_connect(uint16_t port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = ntohs(port);
+    addr.sin_addr.s_addr = ntohl(INADDR_LOOPBACK);
+
+    if (connect(fd, (const struct sockaddr *)&addr, sizeof(addr)))
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static bool io_full(int fd, char *buf, size_t n, bool is_write)
+{
+    while (n > 0)
+    {
+        ssize_t rv = is_write ? write(fd, buf, n) : read(fd, buf, n);
+        if (rv <= 0)
+        {
+            return false;
+        }
+        n -= (size_t)rv;
+        buf += rv;
+    }
+
+    return true;
+}
+
+static void append_req(std::string &req, const std::vector<std::string> &cmd)
+{
+    size_t start = req.size();
+    req.resize(start + 8);
+    uint32_t n = (uint32_t)cmd.size();
+    memcpy(&req[start + 4], &n, 4);
+
+    for (const std::string &arg : cmd)
+    {
+        uint32_t len = (uint32_t)arg.size();
+        req.append((char *)&len, 4);
+        req.append(arg);
+    }
+
+    uint32_t len = (uint32_t)(req.size() - start - 4);
+    memcpy(&req[start], &len, 4);
+}
+
+static bool read_reply(int fd, std::string &reply)
+{
+    uint32_t len = 0;
+    if (!io_full(fd, (char *)&len, 4, false))
+    {
+        return false;
+    }
+
+    reply.resize(len);
+    return io_full(fd, &reply[0], len, false);
+}
+
+// send a request and read the serialized reply
+static bool server_call(int fd, const std::vector<std::string> &cmd, std::string &reply)
+{
+    std::string req;
+    append_req(req, cmd);
+
+    return io_full(fd, &req[0], req.size(), true) && read_reply(fd, reply);
+}
+
+// an integer field of INFO, -1 if not found
+static int64_t server_info(int fd, const char *name)
+{
+    std::string reply;
+    if (!server_call(fd, {"info"}, reply) || reply.empty() || reply[0] != 4)
+    {
+        return -1;
+    }
+
+    // [name, value] pairs, the values are strings or integers
+    size_t pos = 5;
+    while (pos + 5 <= reply.size())
+    {
+        uint32_t len = 0;
+        memcpy(&len, &reply[pos + 1], 4);
+        std::string key = reply.substr(pos + 5, len);
+        pos += 5 + len;
+
+        if (pos >= reply.size())
+        {
+            break;
+        }
+
+        if (reply[pos] == 3)
+        {
+            int64_t val = 0;
+            memcpy(&val, &reply[pos + 1], 8);
+            if (key == name)
+            {
+                return val;
+            }
+            pos += 9;
+        }
+        else
+        {
+            memcpy(&len, &reply[pos + 1], 4);
+            pos += 5 + len;
+        }
+    }
+
+    return -1;
+}
+
+// the server RSS per idle connection, with and without a past request
+static void bench_idle_conns(size_t n_conns)
+{
+    rlimit lim = {};
+    getrlimit(RLIMIT_NOFILE, &lim);
+    lim.rlim_cur = lim.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &lim);
+    n_conns = std::min<size_t>(n_conns, lim.rlim_cur - 64);
+
+    int ctl = server_connect(1234);
+    if (ctl < 0)
+    {
+        printf("idleconns: no server on port 1234\n");
+        return;
+    }
+
+    int64_t base_conns = server_info(ctl, "connected_clients");
+    int64_t base_rss = server_info(ctl, "rss_bytes");
+
+    std::vector<int> fds;
+    for (size_t i = 0; i < n_conns; ++i)
+    {
+        int fd = server_connect(1234);
+        if (fd < 0)
+        {
+            break;
+        }
+        fds.push_back(fd);
+    }
+
+    // the server accepts one connection per event loop iteration
+    while (server_info(ctl, "connected_clients") < base_conns + (int64_t)fds.size())
+    {
+        usleep(1000);
+    }
+    int64_t conn_rss = server_info(ctl, "rss_bytes");
+
+    std::string reply;
+    for (int fd : fds)
+    {
+        if (!server_call(fd, {"get", "idleconns"}, reply))
+        {
+            break;
+        }
+    }
+    int64_t used_rss = server_info(ctl, "rss_bytes");
+
+    printf("%-24s %10s %14s\n", "idle conns", "n_conns", "RSS per conn");
+    printf("%-24s %10zu %14.0f\n", "connected", fds.size(),
+           (double)(conn_rss - base_rss) / (double)fds.size());
+    printf("%-24s %10zu %14.0f\n", "after a request", fds.size(),
+           (double)(used_rss - base_rss) / (double)fds.size());
+
+    for (int fd : fds)
+    {
+        close(fd);
+    }
+    close(ctl);
+}
+
+// requests per second on one connection, sending `depth` requests per write
+static void bench_pipeline(size_t n_reqs)
+{
+    int fd = server_connect(1234);
+    if (fd < 0)
+    {
+        printf("pipeline: no server on port 1234\n");
+        return;
+    }
+
+    std::string reply;
+    if (!server_call(fd, {"set", "pipeline", "v"}, reply))
+    {
+        close(fd);
+        return;
+    }
+
+    printf("%-8s %12s %10s\n", "depth", "reqs/s", "ns/req");
+
+    for (size_t depth : {1, 4, 16, 64, 256})
+    {
+        std::string batch;
+        for (size_t i = 0; i < depth; ++i)
+        {
+            append_req(batch, {"get", "pipeline"});
+        }
+
+        size_t n_batches = std::max<size_t>(n_reqs / depth, 1);
+        uint64_t start = get_monotonic_nsec();
+
+        for (size_t b = 0; b < n_batches; ++b)
+        {
+            if (!io_full(fd, &batch[0], batch.size(), true))
+            {
+                break;
+            }
+            for (size_t i = 0; i < depth; ++i)
+            {
+                if (!read_reply(fd, reply))
+                {
+                    break;
+                }
+            }
+        }
+
+        uint64_t ns = get_monotonic_nsec() - start;
+        printf("%-8zu %12.0f %10.0f\n", depth,
+               (double)(n_batches * depth) * 1e9 / (double)ns,
+               (double)ns / (double)(n_batches * depth));
+    }
+
+    close(fd);
+}
+
+// the latency of single requests while another connection pipelines
+static void bench_fairness(size_t n_reqs)
+{
+    int fd = server_connect(1234);
+    if (fd < 0)
+    {
+        printf("fairness: no server on port 1234\n");
+        return;
+    }
+
+    std::string reply;
+    if (!server_call(fd, {"set", "fairness", "v"}, reply))
+    {
+        close(fd);
+        return;
+    }
+
+    int admin_fd = server_connect(1235);
+
+    printf("%-16s %-8s %10s %10s %10s\n", "background", "port", "p50 us", "p99 us", "max us");
+
+    for (int run = 0; run < 3; ++run)
+    {
+        bool batch = run > 0;
+        int req_fd = run == 2 ? admin_fd : fd;
+        if (req_fd < 0)
+        {
+            break;
+        }
+
+        std::atomic<bool> stop{false};
+        std::thread batcher;
+
+        if (batch)
+        {
+            batcher = std::thread([&stop]() {
+                int bfd = server_connect(1234);
+                std::string batch_req, batch_reply;
+                for (size_t i = 0; i < 256; ++i)
+                {
+                    append_req(batch_req, {"get", "fairness"});
+                }
+
+                while (bfd >= 0 && !stop)
+                {
+                    if (!io_full(bfd, &batch_req[0], batch_req.size(), true))
+                    {
+                        break;
+                    }
+                    for (size_t i = 0; i < 256; ++i)
+                    {
+                        (void)read_reply(bfd, batch_reply);
+                    }
+                }
+
+                close(bfd);
+            });
+            usleep(100000);
+        }
+
+        std::vector<uint64_t> lat;
+        for (size_t i = 0; i < n_reqs; ++i)
+        {
+            uint64_t t0 = get_monotonic_nsec();
+            if (!server_call(req_fd, {"get", "fairness"}, reply))
+            {
+                break;
+            }
+            lat.push_back(get_monotonic_nsec() - t0);
+        }
+
+        stop = true;
+        if (batcher.joinable())
+        {
+            batcher.join();
+        }
+
+        if (lat.empty())
+        {
+            break;
+        }
+
+        std::sort(lat.begin(), lat.end());
+        printf("%-16s %-8s %10.1f %10.1f %10.1f\n", batch ? "pipeline x256" : "none",
+               run == 2 ? "admin" : "data", lat[lat.size() / 2] / 1e3,
+               lat[lat.size() * 99 / 100] / 1e3, lat.back() / 1e3);
+    }
+
+    close(fd);
+    if (admin_fd >= 0)
+    {
+        close(admin_fd);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    size_t n_keys = 1000000;
+    std::vector<std::string> names;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (0 == strcmp(argv[i], "--hugepages"))
+        {
+            hp_enable(true);
+            hm_use_hugepages(true);
+        }
+        else if (argv[i][0] >= '0' && argv[i][0] <= '9')
+        {
+            n_keys = (size_t)atol(argv[i]);
+        }
+        else
+        {
+            names.push_back(argv[i]);
+        }
+    }
+
+    hp_pool_init(&g_entry_pool, sizeof(Entry));
+
+    auto selected = [&](const char *name) {
+        return names.empty() || std::find(names.begin(), names.end(), name) != names.end();
+    };
+
+    if (selected("slab"))
+    {
+        bench_slab(n_keys);
+    }
+
+    if (selected("log"))
+    {
+        bench_log(n_keys / 10);
+    }
+
+    if (selected("hitratio"))
+    {
+        bench_hit_ratio(n_keys / 10);
+    }
+
+    if (selected("lookup"))
+    {
+        bench_lookup(n_keys);
+    }
+
+    if (selected("concurrent"))
+    {
+        for (size_t n_readers = 1; n_readers <= 4; n_readers *= 2)
+        {
+            bench_concurrent(n_keys / 10, n_readers);
+        }
+    }
+
+    if (selected("backends"))
+    {
+        bench_backends(n_keys);
+    }
+
+    // these need a server, not part of the default set
+    auto named = [&](const char *name) {
+        return std::find(names.begin(), names.end(), name) != names.end();
+    };
+
+    if (named("idleconns"))
+    {
+        bench_idle_conns(n_keys);
+    }
+
+    if (named("pipeline"))
+    {
+        bench_pipeline(n_keys);
+    }
+
+    if (named("fairness"))
+    {
+        bench_fairness(n_keys);
+    }
+
+    return 0;
+}
@@ -0,0 +1,324 @@
+#include <assert.h>
+#include <stdlib.h>
+#include "chashtable.h"
+
+const size_t k_max_load_factor = 8;
+const size_t k_resizing_work = 16; // buckets per write
+
+// n must be power for 2
+static CHTab *ch_new_tab(size_t n)
+{
+    assert(n >= k_lock_stripes && ((n - 1) & n) == 0);
+
+    CHTab *h_tab = new CHTab();
+    // all-zero bytes are null atomic pointers
+    h_tab->tab = (std::atomic<CHNode *> *)calloc(sizeof(std::atomic<CHNode *>), n);
+    h_tab->mask = n - 1;
+
+    return h_tab;
+}
+
+static void ch_free_tab(void *ptr)
+{
+    CHTab *h_tab = (CHTab *)ptr;
+
+    free(h_tab->tab);
+    delete h_tab;
+}
+
+// Every table has at least `k_lock_stripes` buckets, so the nodes of a
+// bucket, in both tables, always fall into the same stripe.
+static std::mutex &ch_stripe(CHMap *c_map, uint64_t h_code)
+{
+    return c_map->stripes[h_code & (k_lock_stripes - 1)];
+}
+
+static void ch_lock_all(CHMap *c_map)
+{
+    for (std::mutex &mu : c_map->stripes)
+    {
+        mu.lock();
+    }
+}
+
+static void ch_unlock_all(CHMap *c_map)
+{
+    for (std::mutex &mu : c_map->stripes)
+    {
+        mu.unlock();
+    }
+}
+
+// the lock-free walk of readers, returns the node itself, since
+// its parent pointer may be changed by writers at any time
+static CHNode *ch_find(CHTab *h_tab, CHNode *key, bool (*eq)(CHNode *, CHNode *))
+{
+    if (!h_tab)
+    {
+        return NULL;
+    }
+
+    CHNode *cur = h_tab->tab[key->h_code & h_tab->mask].load(std::memory_order_acquire);
+
+    for (; cur; cur = cur->next.load(std::memory_order_acquire))
+    {
+        if (cur->h_code == key->h_code && eq(cur, key))
+        {
+            return cur;
+        }
+    }
+
+    return NULL;
+}
+
+// Returns the address of the parent pointer like `h_lookup()`.
+// Must be called with the stripe lock.
+static std::atomic<CHNode *> *ch_lookup(
+    CHTab *h_tab, CHNode *key, bool (*eq)(CHNode *, CHNode *))
+{
+    if (!h_tab)
+    {
+        return NULL;
+    }
+
+    std::atomic<CHNode *> *from = &h_tab->tab[key->h_code & h_tab->mask];
+
+    for (CHNode *cur; (cur = from->load(std::memory_order_relaxed)) != NULL;
+         from = &cur->next)
+    {
+        if (cur->h_code == key->h_code && eq(cur, key))
+        {
+            return from;
+        }
+    }
+
+    return NULL;
+}
+
+// publish the node at the head of the chain, with the stripe lock
+static void ch_push(CHTab *h_tab, CHNode *node)
+{
+    std::atomic<CHNode *> &head = h_tab->tab[node->h_code & h_tab->mask];
+
+    node->next.store(head.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    head.store(node, std::memory_order_release);
+}
+
+// Unlink the node, with the stripe lock. Its `next` is left intact,
+// so a reader standing on the node can still finish the chain.
+static CHNode *ch_detach(std::atomic<CHNode *> *from)
+{
+    CHNode *node = from->load(std::memory_order_relaxed);
+    from->store(node->next.load(std::memory_order_relaxed), std::memory_order_release);
+
+    return node;
+}
+
+// replace the tables, readers can tell from an odd `version`
+static void ch_swap_tabs(CHMap *c_map, CHTab *h1, CHTab *h2)
+{
+    c_map->version.fetch_add(1);
+    c_map->h1.store(h1);
+    c_map->h2.store(h2);
+    c_map->version.fetch_add(1);
+}
+
+static void ch_retire_tab(CHMap *c_map, CHTab *h_tab)
+{
+    if (c_map->retire)
+    {
+        c_map->retire(h_tab, &ch_free_tab);
+    }
+    else
+    {
+        std::lock_guard<std::mutex> guard(c_map->resize_lock);
+        h_tab->next_old = c_map->old_tabs;
+        c_map->old_tabs = h_tab;
+    }
+}
+
+// Claim some buckets of [h2] and move their nodes into [h1].
+// The writer that moves the last bucket drops [h2].
+static void chm_help_resizing(CHMap *c_map)
+{
+    CHTab *h2 = c_map->h2.load();
+
+    if (!h2)
+    {
+        return;
+    }
+
+    CHTab *h1 = c_map->h1.load();
+    size_t n_buckets = h2->mask + 1;
+    size_t n_done = 0;
+
+    for (size_t i = 0; i < k_resizing_work; ++i)
+    {
+        size_t pos = h2->migrate_pos.fetch_add(1);
+
+        if (pos >= n_buckets)
+        {
+            break;
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(c_map->stripes[pos & (k_lock_stripes - 1)]);
+
+            std::atomic<CHNode *> *from = &h2->tab[pos];
+            while (from->load(std::memory_order_relaxed))
+            {
+                ch_push(h1, ch_detach(from));
+            }
+        }
+
+        n_done++;
+    }
+
+    if (n_done && h2->n_migrated.fetch_add(n_done) + n_done == n_buckets)
+    {
+        // done, no writer can be using [h2] while all stripes are locked
+        ch_lock_all(c_map);
+        ch_swap_tabs(c_map, h1, NULL);
+        ch_unlock_all(c_map);
+
+        ch_retire_tab(c_map, h2);
+    }
+}
+
+static void chm_start_resizing(CHMap *c_map)
+{
+    std::unique_lock<std::mutex> guard(c_map->resize_lock, std::try_to_lock);
+
+    if (!guard.owns_lock() || c_map->h2.load())
+    {
+        return; // another writer got it
+    }
+
+    CHTab *h1 = c_map->h1.load();
+    if (c_map->size.load() / (h1->mask + 1) < k_max_load_factor)
+    {
+        return;
+    }
+
+    // allocate outside the stripe locks
+    CHTab *bigger = ch_new_tab((h1->mask + 1) * 2);
+
+    ch_lock_all(c_map);
+    ch_swap_tabs(c_map, bigger, h1);
+    ch_unlock_all(c_map);
+}
+
+void chm_init(CHMap *c_map, void (*retire)(void *, void (*)(void *)))
+{
+    c_map->h1.store(ch_new_tab(k_lock_stripes));
+    c_map->retire = retire;
+}
+
+// Without locks, a miss is only certain if the chains were not relinked
+// meanwhile. Nodes are only relinked across tables by the resizing, which
+// keeps [h2] set and bumps `version` around the table swaps. So a miss is
+// retried with the stripe lock if a resizing was seen.
+CHNode *chm_lookup(CHMap *c_map, CHNode *key, bool (*eq)(CHNode *, CHNode *))
+{
+    uint64_t version = c_map->version.load();
+
+    CHNode *node = ch_find(c_map->h1.load(), key, eq);
+    CHTab *h2 = c_map->h2.load();
+    node = node ? node : ch_find(h2, key, eq);
+
+    if (node)
+    {
+        return node;
+    }
+
+    if (!h2 && version % 2 == 0 && version == c_map->version.load())
+    {
+        return NULL;
+    }
+
+    std::lock_guard<std::mutex> guard(ch_stripe(c_map, key->h_code));
+
+    std::atomic<CHNode *> *from = ch_lookup(c_map->h1.load(), key, eq);
+    from = from ? from : ch_lookup(c_map->h2.load(), key, eq);
+
+    return from ? from->load(std::memory_order_relaxed) : NULL;
+}
+
+CHNode *chm_insert(CHMap *c_map, CHNode *node, bool (*eq)(CHNode *, CHNode *))
+{
+    {
+        std::lock_guard<std::mutex> guard(ch_stripe(c_map, node->h_code));
+
+        std::atomic<CHNode *> *from = ch_lookup(c_map->h1.load(), node, eq);
+        from = from ? from : ch_lookup(c_map->h2.load(), node, eq);
+
+        if (from)
+        {
+            return from->load(std::memory_order_relaxed);
+        }
+
+        ch_push(c_map->h1.load(), node);
+    }
+
+    size_t size = c_map->size.fetch_add(1) + 1;
+
+    if (!c_map->h2.load() &&
+        size / (c_map->h1.load()->mask + 1) >= k_max_load_factor)
+    {
+        chm_start_resizing(c_map);
+    }
+
+    chm_help_resizing(c_map);
+
+    return NULL;
+}
+
+CHNode *chm_pop(CHMap *c_map, CHNode *key, bool (*eq)(CHNode *, CHNode *))
+{
+    CHNode *node = NULL;
+
+    {
+        std::lock_guard<std::mutex> guard(ch_stripe(c_map, key->h_code));
+
+        std::atomic<CHNode *> *from = ch_lookup(c_map->h1.load(), key, eq);
+        from = from ? from : ch_lookup(c_map->h2.load(), key, eq);
+
+        if (from)
+        {
+            node = ch_detach(from);
+            c_map->size.fetch_sub(1);
+        }
+    }
+
+    chm_help_resizing(c_map);
+
+    return node;
+}
+
+size_t chm_size(CHMap *c_map)
+{
+    return c_map->size.load();
+}
+
+void chm_destroy(CHMap *c_map)
+{
+    if (CHTab *h1 = c_map->h1.load())
+    {
+        ch_free_tab(h1);
+    }
+
+    if (CHTab *h2 = c_map->h2.load())
+    {
+        ch_free_tab(h2);
+    }
+
+    while (CHTab *h_tab = c_map->old_tabs)
+    {
+        c_map->old_tabs = h_tab->next_old;
+        ch_free_tab(h_tab);
+    }
+
+    c_map->h1.store(NULL);
+    c_map->h2.store(NULL);
+    c_map->size.store(0);
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+
+// A concurrent variant of HMap for a keyspace shared by threads.
+//
+// Readers take no locks. Writers lock one of `k_lock_stripes` stripes by
+// the hash code, and move some buckets of the older table on every write,
+// so the progressive resizing is shared by the writer threads.
+//
+// Removed nodes and old bucket arrays may still be read by lock-free
+// readers, so the map never frees them synchronously:
+// - `chm_pop()` returns the node, the caller decides when to free it.
+// - Old tables are passed to `retire`, which must call `free_fn` once no
+//   thread can be inside a `chm_*` call that started before the retire.
+//   Without `retire`, old tables are kept until `chm_destroy()`.
+
+// hashtable node, should be embedded into the payload
+struct CHNode
+{
+    std::atomic<CHNode *> next{NULL};
+    uint64_t h_code = 0;
+};
+
+// a fixed-sized table, replaced as a whole by the resizing
+struct CHTab
+{
+    std::atomic<CHNode *> *tab = NULL;
+    size_t mask = 0;
+    // the migration of this table as the older one
+    std::atomic<size_t> migrate_pos{0}; // next bucket to claim
+    std::atomic<size_t> n_migrated{0};  // buckets done
+    CHTab *next_old = NULL;             // kept without `retire`
+};
+
+const size_t k_lock_stripes = 64; // power of 2, the minimal table size
+
+struct CHMap
+{
+    std::atomic<CHTab *> h1{NULL}; // newer
+    std::atomic<CHTab *> h2{NULL}; // older
+    std::atomic<size_t> size{0};
+    // odd while the tables are being swapped, see `chm_lookup()`
+    std::atomic<uint64_t> version{0};
+    std::mutex stripes[k_lock_stripes];
+    std::mutex resize_lock; // one resizing at a time
+    void (*retire)(void *ptr, void (*free_fn)(void *)) = NULL;
+    CHTab *old_tabs = NULL;
+};
+
+void chm_init(CHMap *c_map, void (*retire)(void *, void (*)(void *)));
+
+// lock free
+CHNode *chm_lookup(CHMap *c_map, CHNode *key, bool (*eq)(CHNode *, CHNode *));
+
+// Insert the node unless the key exists, in which case the existing node
+// is returned. The check and the insertion are atomic.
+CHNode *chm_insert(CHMap *c_map, CHNode *node, bool (*eq)(CHNode *, CHNode *));
+
+CHNode *chm_pop(CHMap *c_map, CHNode *key, bool (*eq)(CHNode *, CHNode *));
+
+size_t chm_size(CHMap *c_map);
+
+// not thread safe, the nodes are owned by the caller
+void chm_destroy(CHMap *c_map);
@@ -4,6 +4,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <time.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
@@ -57,9 +58,13 @@ static int32_t write_all(int fd, const char *buf, size_t n)
 
 const size_t k_max_msg = 4096;
 
-static int32_t send_req(int fd, const std::vector<std::string> &cmd)
+// set in the argument count when a deadline follows it
+const uint32_t k_req_deadline = 1u << 31;
+
+// `deadline` in microseconds since the Unix epoch, 0 for none
+static int32_t send_req(int fd, const std::vector<std::string> &cmd, uint64_t deadline)
 {
-    uint32_t len = 4;
+    uint32_t len = deadline ? 4 + 8 : 4;
     for (const std::string &s : cmd)
     {
         len += 4 + s.size();
@@ -72,8 +77,17 @@ static int32_t send_req(int fd, const std::vector<std::string> &cmd)
     char wbuf[4 + k_max_msg];
     memcpy(&wbuf[0], &len, 4); // assume little endian
     uint32_t n = cmd.size();
+    if (deadline)
+    {
+        n |= k_req_deadline;
+    }
     memcpy(&wbuf[4], &n, 4);
     size_t cur = 8;
+    if (deadline)
+    {
+        memcpy(&wbuf[cur], &deadline, 8);
+        cur += 8;
+    }
     for (const std::string &s : cmd)
     {
         uint32_t p = (uint32_t)s.size();
@@ -91,6 +105,7 @@ enum
     SER_STR = 2,
     SER_INT = 3,
     SER_ARR = 4,
+    SER_DBL = 5,
 };
 
 static int32_t on_response(const uint8_t *data, size_t size)
@@ -153,6 +168,18 @@ static int32_t on_response(const uint8_t *data, size_t size)
             printf("(int) %ld\n", val);
             return 1 + 8;
         }
+    case SER_DBL:
+        if (size < 1 + 8)
+        {
+            msg("bad response");
+            return -1;
+        }
+        {
+            double val = 0;
+            memcpy(&val, &data[1], 8);
+            printf("(dbl) %g\n", val);
+            return 1 + 8;
+        }
     case SER_ARR:
         if (size < 1 + 4)
         {
@@ -245,12 +272,23 @@ int main(int argc, char **argv)
         die("connect");
     }
 
+    // ./client [--deadline <ms>] cmd...
+    uint64_t deadline = 0;
+    int start = 1;
+    if (argc > 2 && 0 == strcmp(argv[1], "--deadline"))
+    {
+        timespec tv = {0, 0};
+        clock_gettime(CLOCK_REALTIME, &tv);
+        deadline = uint64_t(tv.tv_sec) * 1000000 + tv.tv_nsec / 1000 + atoll(argv[2]) * 1000;
+        start = 3;
+    }
+
     std::vector<std::string> cmd;
-    for (int i = 1; i < argc; ++i)
+    for (int i = start; i < argc; ++i)
     {
         cmd.push_back(argv[i]);
     }
-    int32_t err = send_req(fd, cmd);
+    int32_t err = send_req(fd, cmd, deadline);
     if (err)
     {
         goto L_DONE;
@@ -0,0 +1,201 @@
+#include <assert.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include "epoch.h"
+
+const size_t k_collect_batch = 64; // retires between collections
+
+struct Retired
+{
+    void *ptr = NULL;
+    void (*free_fn)(void *) = NULL;
+    uint64_t epoch = 0;
+};
+
+// per-thread state, records are reused but never freed
+struct EpochRecord
+{
+    std::atomic<uint64_t> epoch{0};
+    std::atomic<bool> active{false};
+    std::atomic<bool> in_use{false};
+    uint32_t depth = 0;            // nested `epoch_enter()`
+    std::vector<Retired> retired; // only used by the owner
+    EpochRecord *next = NULL;     // immutable once published
+};
+
+static std::atomic<uint64_t> g_epoch{0};
+static std::atomic<EpochRecord *> g_records{NULL};
+
+// retired memory left by exited threads
+static std::mutex g_orphans_lock;
+static std::vector<Retired> g_orphans;
+
+static std::atomic<size_t> g_backlog{0};
+static std::atomic<uint64_t> g_n_retired{0};
+static std::atomic<uint64_t> g_n_freed{0};
+
+static thread_local EpochRecord *t_record = NULL;
+
+static EpochRecord *epoch_self()
+{
+    if (t_record)
+    {
+        return t_record;
+    }
+
+    // reuse the record of an exited thread
+    for (EpochRecord *rec = g_records.load(); rec; rec = rec->next)
+    {
+        bool expected = false;
+        if (rec->in_use.compare_exchange_strong(expected, true))
+        {
+            return t_record = rec;
+        }
+    }
+
+    EpochRecord *rec = new EpochRecord();
+    rec->in_use = true;
+    rec->next = g_records.load();
+
+    while (!g_records.compare_exchange_weak(rec->next, rec))
+    {
+    }
+
+    return t_record = rec;
+}
+
+void epoch_enter()
+{
+    EpochRecord *rec = epoch_self();
+
+    if (rec->depth++ == 0)
+    {
+        rec->epoch.store(g_epoch.load());
+        rec->active.store(true);
+    }
+}
+
+void epoch_exit()
+{
+    EpochRecord *rec = epoch_self();
+    assert(rec->depth > 0);
+
+    if (--rec->depth == 0)
+    {
+        rec->active.store(false);
+    }
+}
+
+// advance if every active thread has observed the current epoch
+static void epoch_try_advance()
+{
+    uint64_t epoch = g_epoch.load();
+
+    for (EpochRecord *rec = g_records.load(); rec; rec = rec->next)
+    {
+        if (rec->active.load() && rec->epoch.load() != epoch)
+        {
+            return;
+        }
+    }
+
+    (void)g_epoch.compare_exchange_strong(epoch, epoch + 1);
+}
+
+// free the items that are 2 epochs old, keep the rest
+static size_t epoch_free(std::vector<Retired> &retired)
+{
+    uint64_t epoch = g_epoch.load();
+    size_t n_kept = 0;
+
+    for (size_t i = 0; i < retired.size(); ++i)
+    {
+        Retired &item = retired[i];
+
+        if (item.epoch + 2 <= epoch)
+        {
+            item.free_fn(item.ptr);
+        }
+        else
+        {
+            retired[n_kept++] = item;
+        }
+    }
+
+    size_t n_freed = retired.size() - n_kept;
+    retired.resize(n_kept);
+
+    g_backlog -= n_freed;
+    g_n_freed += n_freed;
+
+    return n_freed;
+}
+
+void epoch_retire(void *ptr, void (*free_fn)(void *))
+{
+    EpochRecord *rec = epoch_self();
+
+    Retired item;
+    item.ptr = ptr;
+    item.free_fn = free_fn;
+    item.epoch = g_epoch.load();
+    rec->retired.push_back(item);
+
+    g_backlog++;
+    g_n_retired++;
+
+    if (rec->retired.size() % k_collect_batch == 0)
+    {
+        (void)epoch_collect();
+    }
+}
+
+size_t epoch_collect()
+{
+    EpochRecord *rec = epoch_self();
+
+    // outside of critical sections, 2 steps make everything collectable
+    epoch_try_advance();
+    epoch_try_advance();
+
+    size_t n_freed = epoch_free(rec->retired);
+
+    std::unique_lock<std::mutex> guard(g_orphans_lock, std::try_to_lock);
+    if (guard.owns_lock() && !g_orphans.empty())
+    {
+        n_freed += epoch_free(g_orphans);
+    }
+
+    return n_freed;
+}
+
+void epoch_thread_exit()
+{
+    EpochRecord *rec = t_record;
+
+    if (!rec)
+    {
+        return;
+    }
+
+    assert(rec->depth == 0);
+
+    {
+        std::lock_guard<std::mutex> guard(g_orphans_lock);
+        g_orphans.insert(g_orphans.end(), rec->retired.begin(), rec->retired.end());
+    }
+
+    rec->retired.clear();
+    rec->active = false;
+    rec->in_use = false;
+    t_record = NULL;
+}
+
+void epoch_stats(EpochStats *stats)
+{
+    stats->epoch = g_epoch.load();
+    stats->backlog = g_backlog.load();
+    stats->n_retired = g_n_retired.load();
+    stats->n_freed = g_n_freed.load();
+}
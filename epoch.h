@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Epoch-based memory reclamation.
+//
+// A thread reads shared data between `epoch_enter()` and `epoch_exit()`.
+// Memory that was unlinked from shared data is passed to `epoch_retire()`
+// instead of being freed, and freed in batches once every thread that
+// could still see it has left its critical section.
+//
+// The global epoch only advances when all active threads have observed
+// it, so anything retired in epoch `e` is unreachable at epoch `e + 2`.
+
+// reentrant, registers the calling thread on the first call
+void epoch_enter();
+
+void epoch_exit();
+
+// `free_fn(ptr)` is called later, from some thread's `epoch_collect()`
+void epoch_retire(void *ptr, void (*free_fn)(void *));
+
+// try to advance the epoch and free what is safe, returns the freed count
+size_t epoch_collect();
+
+// hand the remaining retired memory over to other threads
+void epoch_thread_exit();
+
+struct EpochStats
+{
+    uint64_t epoch = 0;
+    size_t backlog = 0; // retired but not freed yet
+    uint64_t n_retired = 0;
+    uint64_t n_freed = 0;
+};
+
+void epoch_stats(EpochStats *stats);
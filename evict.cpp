@@ -0,0 +1,265 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "evict.h"
+
+const uint32_t k_lru_bits = 24; // wraps after 194 days of seconds
+const uint32_t k_lru_max = (1u << k_lru_bits) - 1;
+const uint32_t k_lfu_init = 5;        // the counter of a new key
+const uint32_t k_lfu_log_factor = 10; // 255 is about 1M accesses
+const uint32_t k_lfu_decay_min = 1;   // minutes per counter decrement
+
+static const char *k_policy_names[] = {
+    "noeviction", "allkeys-lru", "allkeys-lfu", "volatile-lru", "volatile-lfu",
+};
+
+static uint64_t g_clock_sec = 0;
+
+int evict_policy(const char *name)
+{
+    for (size_t i = 0; i < sizeof(k_policy_names) / sizeof(k_policy_names[0]); ++i)
+    {
+        if (0 == strcmp(name, k_policy_names[i]))
+        {
+            return (int)i;
+        }
+    }
+
+    return -1;
+}
+
+const char *evict_policy_name(int policy)
+{
+    return k_policy_names[policy];
+}
+
+bool evict_is_lfu(int policy)
+{
+    return policy == EVICT_ALLKEYS_LFU || policy == EVICT_VOLATILE_LFU;
+}
+
+void evict_update_clock()
+{
+    timespec tv = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+
+    evict_set_clock((uint64_t)tv.tv_sec);
+}
+
+void evict_set_clock(uint64_t sec)
+{
+    g_clock_sec = sec;
+}
+
+static uint32_t lru_clock()
+{
+    return (uint32_t)(g_clock_sec & k_lru_max);
+}
+
+static uint32_t lfu_minutes()
+{
+    return (uint32_t)((g_clock_sec / 60) & 0xffff);
+}
+
+// the counter after the decay since the last access
+static uint32_t lfu_decayed(uint32_t access)
+{
+    uint32_t elapsed = (lfu_minutes() - (access >> 8)) & 0xffff;
+    uint32_t counter = access & 0xff;
+    uint32_t n_decr = elapsed / k_lfu_decay_min;
+
+    return n_decr > counter ? 0 : counter - n_decr;
+}
+
+void evict_init(Entry *ent, int policy)
+{
+    ent->access = evict_is_lfu(policy) ? (lfu_minutes() << 8) | k_lfu_init : lru_clock();
+}
+
+void evict_touch(Entry *ent, int policy)
+{
+    if (!evict_is_lfu(policy))
+    {
+        ent->access = lru_clock();
+        return;
+    }
+
+    // a logarithmic counter, the increment gets less likely as it grows
+    uint32_t counter = lfu_decayed(ent->access);
+    if (counter < 255)
+    {
+        uint32_t base = counter > k_lfu_init ? counter - k_lfu_init : 0;
+        double p = 1.0 / (base * k_lfu_log_factor + 1);
+
+        if ((double)rand() / RAND_MAX < p)
+        {
+            counter++;
+        }
+    }
+
+    ent->access = (lfu_minutes() << 8) | counter;
+}
+
+uint64_t evict_score(Entry *ent, int policy)
+{
+    if (evict_is_lfu(policy))
+    {
+        return 255 - lfu_decayed(ent->access);
+    }
+
+    return (lru_clock() - ent->access) & k_lru_max;
+}
+
+// keep the pool sorted, drop the worst candidate when it is full
+static void pool_insert(EvictPool *pool, Entry *ent, uint64_t score)
+{
+    size_t pos = 0;
+    while (pos < pool->n && pool->scores[pos] < score)
+    {
+        pos++;
+    }
+
+    for (size_t i = 0; i < pool->n; ++i)
+    {
+        if (pool->keys[i] == ent->key)
+        {
+            return; // already a candidate
+        }
+    }
+
+    if (pool->n == k_evict_pool_size)
+    {
+        if (pos == 0)
+        {
+            return; // worse than all of them
+        }
+
+        // shift the lower ones down over the worst
+        for (size_t i = 1; i < pos; ++i)
+        {
+            pool->scores[i - 1] = pool->scores[i];
+            pool->keys[i - 1].swap(pool->keys[i]);
+        }
+        pos--;
+    }
+    else
+    {
+        for (size_t i = pool->n; i > pos; --i)
+        {
+            pool->scores[i] = pool->scores[i - 1];
+            pool->keys[i].swap(pool->keys[i - 1]);
+        }
+        pool->n++;
+    }
+
+    pool->scores[pos] = score;
+    pool->keys[pos] = ent->key;
+}
+
+// merge the eligible entries of a chain, returns how many
+static size_t pool_add_chain(EvictPool *pool, HNode *node, int policy,
+                             bool (*eligible)(Entry *))
+{
+    size_t n_added = 0;
+
+    for (; node; node = node->next)
+    {
+        Entry *ent = EntryMap::owner(node);
+
+        if (!eligible || eligible(ent))
+        {
+            pool_insert(pool, ent, evict_score(ent, policy));
+            n_added++;
+        }
+    }
+
+    return n_added;
+}
+
+// the bucket at `pos` of the two tables, [h1] then [h2]
+static HNode *table_bucket(EntryMap *hmap, size_t pos)
+{
+    HTab *h1 = &hmap->map.h1;
+    size_t n1 = h1->tab ? h1->mask + 1 : 0;
+
+    return pos < n1 ? h1->tab[pos] : hmap->map.h2.tab[pos - n1];
+}
+
+static size_t table_buckets(EntryMap *hmap)
+{
+    HTab *h1 = &hmap->map.h1;
+    HTab *h2 = &hmap->map.h2;
+
+    return (h1->tab ? h1->mask + 1 : 0) + (h2->tab ? h2->mask + 1 : 0);
+}
+
+void evict_pool_fill(EvictPool *pool, Keyspace *ks, int policy,
+                     const EvictScope *scope)
+{
+    size_t n_slots = ks_n_slots(ks);
+    size_t n_sampled = 0;
+    bool (*eligible)(Entry *) = scope ? scope->eligible : NULL;
+
+    assert(n_slots);
+
+    if (scope && scope->sample)
+    {
+        for (size_t i = 0; i < k_evict_samples; ++i)
+        {
+            if (Entry *ent = scope->sample())
+            {
+                pool_insert(pool, ent, evict_score(ent, policy));
+            }
+        }
+        return;
+    }
+
+    if (!ks_size(ks))
+    {
+        return;
+    }
+
+    // from a random slot and bucket on to the next occupied ones, so that
+    // sparse slots and tables cost a walk instead of a failed try
+    for (size_t tries = 0; n_sampled < k_evict_samples && tries < 16 * k_evict_samples; ++tries)
+    {
+        size_t slot = (size_t)rand() % n_slots;
+        EntryMap *hmap = NULL;
+
+        for (size_t i = 0; !hmap && i < n_slots; ++i)
+        {
+            hmap = ks_slot(ks, (slot + i) % n_slots);
+        }
+
+        size_t n_buckets = hmap ? table_buckets(hmap) : 0;
+        if (!n_buckets)
+        {
+            break;
+        }
+
+        size_t pos = (size_t)rand() % n_buckets;
+        HNode *chain = NULL;
+
+        for (size_t i = 0; !chain && i < n_buckets; ++i)
+        {
+            chain = table_bucket(hmap, (pos + i) % n_buckets);
+        }
+
+        n_sampled += pool_add_chain(pool, chain, policy, eligible);
+    }
+}
+
+bool evict_pool_pop(EvictPool *pool, std::string &key)
+{
+    if (pool->n == 0)
+    {
+        return false;
+    }
+
+    pool->n--;
+    key.swap(pool->keys[pool->n]);
+    pool->keys[pool->n].clear();
+
+    return true;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#include "keyspace.h"
+
+// Eviction policies for `maxmemory`.
+//
+// Each Entry keeps a 32-bit access field: the LRU clock of the last
+// access, or the LFU pair of a 16-bit decay time in minutes and an 8-bit
+// logarithmic counter. Victims are sampled from random hashtable buckets,
+// or by the caller for the volatile policies, into a small pool that keeps
+// the best candidates across evictions.
+
+enum
+{
+    EVICT_NONE = 0, // `noeviction`, writes fail over the limit
+    EVICT_ALLKEYS_LRU = 1,
+    EVICT_ALLKEYS_LFU = 2,
+    EVICT_VOLATILE_LRU = 3, // only the keys with an expiration
+    EVICT_VOLATILE_LFU = 4,
+};
+
+const size_t k_evict_samples = 5;     // entries sampled per pool refill
+const size_t k_evict_pool_size = 16;
+
+// -1 for an unknown name
+int evict_policy(const char *name);
+
+const char *evict_policy_name(int policy);
+
+bool evict_is_lfu(int policy);
+
+// the coarse clock, updated once per event loop iteration
+void evict_update_clock();
+
+// a logical clock in seconds, for simulations
+void evict_set_clock(uint64_t sec);
+
+// a new entry, LFU counters start above 0 to survive a little
+void evict_init(Entry *ent, int policy);
+
+void evict_touch(Entry *ent, int policy);
+
+// larger is a better victim: the idle time, or the inverse frequency
+uint64_t evict_score(Entry *ent, int policy);
+
+// the candidates, sorted by increasing score, by key since they may be
+// deleted while in the pool
+struct EvictPool
+{
+    size_t n = 0;
+    uint64_t scores[k_evict_pool_size];
+    std::string keys[k_evict_pool_size];
+};
+
+// The keys a policy may evict, all of them if NULL. `sample` draws them
+// at random without looking at the others, e.g. from the TTL heap.
+struct EvictScope
+{
+    bool (*eligible)(Entry *ent) = NULL;
+    Entry *(*sample)() = NULL; // NULL if there are none
+};
+
+// Sample random buckets of a hashtable backend, or `scope->sample`, and
+// merge the eligible entries into the pool. Bounded, a rare kind of
+// eligible key may not be found.
+void evict_pool_fill(EvictPool *pool, Keyspace *ks, int policy,
+                     const EvictScope *scope);
+
+// take the best candidate, false if the pool is empty
+bool evict_pool_pop(EvictPool *pool, std::string &key);
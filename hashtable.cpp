@@ -1,16 +1,86 @@
 #include <assert.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 #include "hashtable.h"
 
 const size_t k_max_load_factor = 8;
 const size_t k_resizing_work = 128;
+const size_t k_mmap_threshold = 1 << 20; // 1 MiB of buckets
+
+static bool g_use_hugepages = false;
+static void (*g_retire)(void *ptr, void (*free_fn)(void *)) = NULL;
+
+void hm_use_hugepages(bool on)
+{
+    g_use_hugepages = on;
+}
+
+void hm_set_retire(void (*retire)(void *ptr, void (*free_fn)(void *)))
+{
+    g_retire = retire;
+}
+
+// Big bucket arrays come from anonymous mappings, which the kernel
+// zero-fills lazily on first touch. So starting a resize costs the same
+// regardless of the table size, unlike `calloc()` which may clear the
+// whole array up front. Only those are hinted for huge pages, smaller
+// arrays could not fill one.
+static HNode **h_alloc_tab(size_t n)
+{
+    size_t bytes = n * sizeof(HNode *);
+
+    if (bytes < k_mmap_threshold)
+    {
+        return (HNode **)calloc(sizeof(HNode *), n);
+    }
+
+    void *ptr = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assert(ptr != MAP_FAILED);
+
+#ifdef MADV_HUGEPAGE
+    if (g_use_hugepages)
+    {
+        (void)madvise(ptr, bytes, MADV_HUGEPAGE); // best effort
+    }
+#endif
+
+    return (HNode **)ptr;
+}
+
+static void h_free_tab(HTab *h_tab)
+{
+    if (!h_tab->tab)
+    {
+        return;
+    }
+
+    size_t bytes = (h_tab->mask + 1) * sizeof(HNode *);
+
+    if (bytes < k_mmap_threshold)
+    {
+        free(h_tab->tab);
+    }
+    else
+    {
+        (void)munmap(h_tab->tab, bytes);
+    }
+}
+
+static void h_free_retired(void *ptr)
+{
+    HTab *h_tab = (HTab *)ptr;
+
+    h_free_tab(h_tab);
+    delete h_tab;
+}
 
 // n must be power for 2
 static void h_init(HTab *h_tab, size_t n)
 {
     assert(n > 0 && ((n - 1) & n) == 0);
 
-    h_tab->tab = (HNode **)calloc(sizeof(HNode *), n);
+    h_tab->tab = h_alloc_tab(n);
     h_tab->mask = n - 1;
     h_tab->size = 0;
 }
@@ -31,7 +101,8 @@ static void h_insert(HTab *h_tab, HNode *node)
 // Pay attention to the return value. It return the address of
 // the parent pointer that owns the target node,
 // which can be used to delete the target node.
-static HNode **h_lookup(HTab *h_tab, HNode *key, bool (*eq)(HNode *, HNode *))
+static HNode **h_lookup(HTab *h_tab, HNode *key, bool (*eq)(HNode *, HNode *),
+                        uint64_t *n_probes)
 {
     if (!h_tab->tab)
     {
@@ -43,6 +114,8 @@ static HNode **h_lookup(HTab *h_tab, HNode *key, bool (*eq)(HNode *, HNode *))
 
     for (HNode *cur; (cur = *from) != NULL; from = &cur->next)
     {
+        (*n_probes)++;
+
         if (cur->h_code == key->h_code && eq(cur, key))
         {
             return from;
@@ -62,7 +135,7 @@ static HNode *h_detach(HTab *h_tab, HNode **from)
     return node;
 }
 
-static void hm_help_resizing(HMap *h_map)
+void hm_help_resizing(HMap *h_map)
 {
     size_t n_work = 0;
 
@@ -84,7 +157,14 @@ static void hm_help_resizing(HMap *h_map)
     if (h_map->h2.size == 0 && h_map->h2.tab)
     {
         // done
-        free(h_map->h2.tab);
+        if (g_retire)
+        {
+            g_retire(new HTab(h_map->h2), &h_free_retired);
+        }
+        else
+        {
+            h_free_tab(&h_map->h2);
+        }
         h_map->h2 = HTab{};
     }
 }
@@ -104,9 +184,13 @@ HNode *hm_lookup(HMap *h_map, HNode *key, bool (*eq)(HNode *, HNode *))
 {
 
     hm_help_resizing(h_map);
+    h_map->n_lookups++;
 
-    HNode **from = h_lookup(&h_map->h1, key, eq);
-    from = from ? from : h_lookup(&h_map->h2, key, eq);
+    HNode **from = h_lookup(&h_map->h1, key, eq, &h_map->n_probes);
+    if (!from && (from = h_lookup(&h_map->h2, key, eq, &h_map->n_probes)))
+    {
+        h_map->n_h2_hits++;
+    }
 
     return from ? *from : NULL;
 }
@@ -137,14 +221,16 @@ void hm_insert(HMap *h_map, HNode *node)
 HNode *hm_pop(HMap *h_map, HNode *key, bool (*eq)(HNode *, HNode *))
 {
     hm_help_resizing(h_map);
+    h_map->n_lookups++;
 
-    if (HNode **from = h_lookup(&h_map->h1, key, eq))
+    if (HNode **from = h_lookup(&h_map->h1, key, eq, &h_map->n_probes))
     {
         return h_detach(&h_map->h1, from);
     }
 
-    if (HNode **from = h_lookup(&h_map->h2, key, eq))
+    if (HNode **from = h_lookup(&h_map->h2, key, eq, &h_map->n_probes))
     {
+        h_map->n_h2_hits++;
         return h_detach(&h_map->h2, from);
     }
 
@@ -158,8 +244,103 @@ size_t hm_size(HMap *h_map)
 
 void hm_destroy(HMap *h_map)
 {
-    free(h_map->h1.tab);
-    free(h_map->h2.tab);
+    h_free_tab(&h_map->h1);
+    h_free_tab(&h_map->h2);
 
     *h_map = HMap{};
-}
\ No newline at end of file
+}
+
+void hm_tab_stats(HTab *h_tab, HTabStats *stats, size_t max_samples)
+{
+    *stats = HTabStats{};
+
+    if (!h_tab->tab)
+    {
+        return;
+    }
+
+    stats->n_buckets = h_tab->mask + 1;
+    stats->size = h_tab->size;
+
+    // sample random buckets of big tables
+    bool sampling = stats->n_buckets > max_samples;
+    stats->n_sampled = sampling ? max_samples : stats->n_buckets;
+
+    for (size_t i = 0; i < stats->n_sampled; ++i)
+    {
+        size_t pos = sampling ? ((size_t)rand() & h_tab->mask) : i;
+        size_t len = 0;
+
+        for (HNode *node = h_tab->tab[pos]; node; node = node->next)
+        {
+            len++;
+        }
+
+        stats->chain_hist[len < k_chain_hist ? len : k_chain_hist]++;
+        stats->max_chain = len > stats->max_chain ? len : stats->max_chain;
+    }
+}
+
+// reverse the bits of the cursor
+static uint64_t rev_bits(uint64_t v)
+{
+    v = ((v >> 1) & 0x5555555555555555) | ((v & 0x5555555555555555) << 1);
+    v = ((v >> 2) & 0x3333333333333333) | ((v & 0x3333333333333333) << 2);
+    v = ((v >> 4) & 0x0F0F0F0F0F0F0F0F) | ((v & 0x0F0F0F0F0F0F0F0F) << 4);
+
+    return __builtin_bswap64(v);
+}
+
+// increment the high bits first, the cursor is a reversed bucket index
+static uint64_t next_cursor(uint64_t v, size_t mask)
+{
+    v |= ~(uint64_t)mask;
+    v = rev_bits(v);
+    v++;
+
+    return rev_bits(v);
+}
+
+static void h_scan_bucket(HTab *h_tab, size_t pos, void (*f)(HNode *, void *), void *arg)
+{
+    for (HNode *node = h_tab->tab[pos]; node; node = node->next)
+    {
+        f(node, arg);
+    }
+}
+
+// Since the table grows by doubling, the nodes of bucket `i` can only go
+// to the buckets with the same low bits. Iterating the reversed cursor
+// visits those buckets together, both in the smaller and the larger
+// table, so a node present during the whole iteration is visited at least
+// once, no matter how the resizing has moved it.
+uint64_t hm_scan(HMap *h_map, uint64_t cursor, void (*f)(HNode *, void *), void *arg)
+{
+    if (!h_map->h1.tab)
+    {
+        return 0;
+    }
+
+    if (!h_map->h2.tab)
+    {
+        // not resizing, only one table
+        h_scan_bucket(&h_map->h1, cursor & h_map->h1.mask, f, arg);
+
+        return next_cursor(cursor, h_map->h1.mask);
+    }
+
+    // while resizing, [h2] is the older and smaller one
+    HTab *small = &h_map->h2;
+    HTab *large = &h_map->h1;
+
+    h_scan_bucket(small, cursor & small->mask, f, arg);
+
+    // the buckets of the larger table that expand from the small bucket
+    do
+    {
+        h_scan_bucket(large, cursor & large->mask, f, arg);
+        cursor = next_cursor(cursor, large->mask);
+    } while (cursor & (small->mask ^ large->mask));
+
+    return cursor;
+}
@@ -25,6 +25,22 @@ struct HMap
     HTab h1; // newer
     HTab h2; // older
     size_t resizing_pos = 0;
+    // cumulative lookup statistics
+    uint64_t n_lookups = 0;
+    uint64_t n_probes = 0;  // nodes visited in the chains
+    uint64_t n_h2_hits = 0; // keys found in the older table
+};
+
+const size_t k_chain_hist = 16; // the last slot counts longer chains
+
+// chain lengths of a table, from all or some random buckets
+struct HTabStats
+{
+    size_t n_buckets = 0;
+    size_t size = 0;
+    size_t n_sampled = 0;
+    size_t max_chain = 0;
+    size_t chain_hist[k_chain_hist + 1] = {};
 };
 
 HNode *hm_lookup(HMap *h_map, HNode *key, bool (*eq)(HNode *, HNode *));
@@ -35,4 +51,22 @@ HNode *hm_pop(HMap *h_map, HNode *key, bool (*eq)(HNode *, HNode *));
 
 size_t hm_size(HMap *h_map);
 
+// Visit the nodes of a cursor position, returns the next cursor.
+// The iteration starts and ends with cursor 0. The cursor stays valid
+// while the map grows, nodes may be visited more than once.
+uint64_t hm_scan(HMap *h_map, uint64_t cursor, void (*f)(HNode *, void *), void *arg);
+
+// inspect at most `max_samples` buckets
+void hm_tab_stats(HTab *h_tab, HTabStats *stats, size_t max_samples);
+
+// advise the kernel to back big bucket arrays with huge pages
+void hm_use_hugepages(bool on);
+
+// Drained bucket arrays are passed to `retire` instead of being freed,
+// which calls `free_fn(ptr)` when no reader can see the array anymore.
+void hm_set_retire(void (*retire)(void *ptr, void (*free_fn)(void *)));
+
+// move some nodes from [h2] to [h1], called on every map operation
+void hm_help_resizing(HMap *h_map);
+
 void hm_destroy(HMap *h_map);
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// a binary min-heap in an array, items track their position through `ref`
+struct HeapItem
+{
+    uint64_t val = 0;
+    uint32_t *ref = NULL;
+};
+
+// restore the heap order after `a[pos]` has changed
+void heap_update(HeapItem *a, size_t pos, size_t len);
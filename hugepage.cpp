@@ -0,0 +1,172 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "hugepage.h"
+
+static bool g_enabled = false;
+
+void hp_enable(bool on)
+{
+    g_enabled = on;
+}
+
+bool hp_enabled()
+{
+    return g_enabled;
+}
+
+static size_t round_up(size_t bytes)
+{
+    return (bytes + k_hugepage_size - 1) & ~(k_hugepage_size - 1);
+}
+
+static void *map_anon(size_t bytes, int extra_flags)
+{
+    void *ptr = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | extra_flags, -1, 0);
+
+    return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+void *map_aligned(size_t bytes, size_t align)
+{
+    assert((align & (align - 1)) == 0 && bytes % align == 0);
+
+    // map a bit more and trim both ends
+    uint8_t *raw = (uint8_t *)map_anon(bytes + align, 0);
+
+    if (!raw)
+    {
+        return NULL;
+    }
+
+    uint8_t *ptr = (uint8_t *)(((uintptr_t)raw + align - 1) & ~(uintptr_t)(align - 1));
+    size_t head = ptr - raw;
+    size_t tail = align - head;
+
+    if (head)
+    {
+        (void)munmap(raw, head);
+    }
+
+    if (tail)
+    {
+        (void)munmap(ptr + bytes, tail);
+    }
+
+    return ptr;
+}
+
+void *hp_alloc(size_t bytes)
+{
+    bytes = round_up(bytes);
+
+    if (!g_enabled)
+    {
+        return map_anon(bytes, 0);
+    }
+
+#ifdef MAP_HUGETLB
+    // explicit huge pages, only works if the admin reserved some
+    if (void *ptr = map_anon(bytes, MAP_HUGETLB))
+    {
+        return ptr;
+    }
+#endif
+
+    // transparent huge pages need a 2 MiB aligned range
+    void *ptr = map_aligned(bytes, k_hugepage_size);
+
+    if (!ptr)
+    {
+        return NULL;
+    }
+
+#ifdef MADV_HUGEPAGE
+    (void)madvise(ptr, bytes, MADV_HUGEPAGE); // best effort
+#endif
+
+    return ptr;
+}
+
+void hp_free(void *ptr, size_t bytes)
+{
+    if (ptr)
+    {
+        (void)munmap(ptr, round_up(bytes));
+    }
+}
+
+size_t hp_backed_bytes()
+{
+    FILE *fp = fopen("/proc/self/smaps_rollup", "r");
+
+    if (!fp)
+    {
+        return 0;
+    }
+
+    size_t total = 0;
+    char line[256];
+
+    while (fgets(line, sizeof(line), fp))
+    {
+        size_t kb = 0;
+
+        if (1 == sscanf(line, "AnonHugePages: %zu kB", &kb) ||
+            1 == sscanf(line, "Private_Hugetlb: %zu kB", &kb) ||
+            1 == sscanf(line, "Shared_Hugetlb: %zu kB", &kb))
+        {
+            total += kb * 1024;
+        }
+    }
+
+    fclose(fp);
+
+    return total;
+}
+
+void hp_pool_init(HPPool *pool, size_t obj_size)
+{
+    *pool = HPPool{};
+
+    // room for the free list link and pointer alignment
+    obj_size = obj_size < sizeof(void *) ? sizeof(void *) : obj_size;
+    pool->obj_size = (obj_size + 7) & ~(size_t)7;
+}
+
+void *hp_pool_alloc(HPPool *pool)
+{
+    if (void *ptr = pool->free_list)
+    {
+        pool->free_list = *(void **)ptr;
+        return ptr;
+    }
+
+    if (!pool->cur || pool->cur + pool->obj_size > pool->end)
+    {
+        uint8_t *region = (uint8_t *)hp_alloc(k_hugepage_size);
+
+        if (!region)
+        {
+            return NULL;
+        }
+
+        pool->cur = region;
+        pool->end = region + k_hugepage_size;
+        pool->n_regions++;
+    }
+
+    void *ptr = pool->cur;
+    pool->cur += pool->obj_size;
+
+    return ptr;
+}
+
+void hp_pool_free(HPPool *pool, void *ptr)
+{
+    *(void **)ptr = pool->free_list;
+    pool->free_list = ptr;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+const size_t k_hugepage_size = 2 << 20; // 2 MiB
+
+// Memory regions that are backed by 2 MiB pages if possible.
+//
+// It tries explicit huge pages (hugetlbfs, MAP_HUGETLB) first, then
+// transparent huge pages (MADV_HUGEPAGE), and falls back to normal pages.
+// With huge pages disabled, regions are plain anonymous mappings.
+void hp_enable(bool on);
+
+bool hp_enabled();
+
+// `bytes` is rounded up to a multiple of `k_hugepage_size`
+void *hp_alloc(size_t bytes);
+
+void hp_free(void *ptr, size_t bytes);
+
+// An anonymous mapping of `bytes` aligned to `align`, a power of 2 that
+// divides `bytes`. NULL on failure, freed with munmap().
+void *map_aligned(size_t bytes, size_t align);
+
+// bytes of this process that are really backed by huge pages,
+// as reported by the kernel
+size_t hp_backed_bytes();
+
+// a free list of fixed-sized objects carved from huge page regions
+struct HPPool
+{
+    size_t obj_size = 0;
+    void *free_list = NULL;
+    uint8_t *cur = NULL; // unused part of the latest region
+    uint8_t *end = NULL;
+    size_t n_regions = 0;
+};
+
+void hp_pool_init(HPPool *pool, size_t obj_size);
+
+void *hp_pool_alloc(HPPool *pool);
+
+void hp_pool_free(HPPool *pool, void *ptr);
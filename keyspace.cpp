@@ -0,0 +1,432 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <map>
+#include "art.h"
+#include "hugepage.h"
+#include "keyspace.h"
+
+uint64_t str_hash(const uint8_t *data, size_t len)
+{
+    uint32_t h = 0x811C9DC5;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        h = (h + data[i]) * 0x01000193;
+    }
+
+    return h;
+}
+
+// the chained hashtables, unordered
+//
+// The keys are partitioned into slots by the high bits of the hash, the
+// bucket index uses the low bits. Each slot is a small HMap that is only
+// allocated while it has keys, so an empty slot costs a pointer.
+
+struct KsHash
+{
+    Keyspace ks;
+    size_t n_slots = 0; // a power of 2
+    size_t size = 0;
+    EntryMap **slots = NULL;
+    KsLookupStats stats; // see `ks_lookup_stats()`
+    bool slots_on_hp = false;
+};
+
+static KsHash *hash_of(Keyspace *ks)
+{
+    return (KsHash *)ks;
+}
+
+static size_t hash_slot(KsHash *kh, uint64_t h_code)
+{
+    return (h_code >> 18) & (kh->n_slots - 1);
+}
+
+// keep the counters of a table that leaves the keyspace
+static void hash_retire_stats(KsHash *kh, EntryMap *db)
+{
+    kh->stats.n_lookups += db->map.n_lookups;
+    kh->stats.n_probes += db->map.n_probes;
+    kh->stats.n_h2_hits += db->map.n_h2_hits;
+}
+
+static Entry *hash_lookup(Keyspace *ks, const std::string &key)
+{
+    KsHash *kh = hash_of(ks);
+    uint64_t h_code = str_hash((uint8_t *)key.data(), key.size());
+    EntryMap *db = kh->slots[hash_slot(kh, h_code)];
+
+    if (!db)
+    {
+        kh->stats.n_lookups++;
+        return NULL;
+    }
+
+    return db->lookup(key, h_code);
+}
+
+static void hash_insert(Keyspace *ks, Entry *ent)
+{
+    KsHash *kh = hash_of(ks);
+    ent->node.h_code = str_hash((uint8_t *)ent->key.data(), ent->key.size());
+
+    EntryMap *&db = kh->slots[hash_slot(kh, ent->node.h_code)];
+    if (!db)
+    {
+        db = new EntryMap();
+    }
+
+    db->insert(ent);
+    kh->size++;
+}
+
+static Entry *hash_pop(Keyspace *ks, const std::string &key)
+{
+    KsHash *kh = hash_of(ks);
+    uint64_t h_code = str_hash((uint8_t *)key.data(), key.size());
+
+    EntryMap *&db = kh->slots[hash_slot(kh, h_code)];
+    if (!db)
+    {
+        kh->stats.n_lookups++;
+        return NULL;
+    }
+
+    Entry *ent = db->pop(key, h_code);
+    if (!ent)
+    {
+        return NULL;
+    }
+
+    kh->size--;
+    if (db->size() == 0)
+    {
+        hash_retire_stats(kh, db);
+        db->destroy();
+        delete db;
+        db = NULL;
+    }
+
+    return ent;
+}
+
+static size_t hash_size(Keyspace *ks)
+{
+    return hash_of(ks)->size;
+}
+
+static bool h_for_each(HTab *h_tab, bool (*f)(Entry *, void *), void *arg)
+{
+    for (size_t i = 0; h_tab->tab && i < h_tab->mask + 1; ++i)
+    {
+        for (HNode *node = h_tab->tab[i]; node; node = node->next)
+        {
+            if (!f(EntryMap::owner(node), arg))
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static void hash_for_each(Keyspace *ks, bool (*f)(Entry *, void *), void *arg)
+{
+    KsHash *kh = hash_of(ks);
+
+    for (size_t i = 0; i < kh->n_slots; ++i)
+    {
+        EntryMap *db = kh->slots[i];
+
+        if (db && !(h_for_each(&db->map.h1, f, arg) && h_for_each(&db->map.h2, f, arg)))
+        {
+            return;
+        }
+    }
+}
+
+static void hash_destroy(Keyspace *ks)
+{
+    KsHash *kh = hash_of(ks);
+
+    for (size_t i = 0; i < kh->n_slots; ++i)
+    {
+        if (EntryMap *db = kh->slots[i])
+        {
+            db->destroy();
+            delete db;
+        }
+    }
+
+    if (kh->slots_on_hp)
+    {
+        hp_free(kh->slots, kh->n_slots * sizeof(EntryMap *));
+    }
+    else
+    {
+        free(kh->slots);
+    }
+    delete kh;
+}
+
+static const KeyspaceOps k_hmap_ops = {
+    "hmap", &hash_lookup, &hash_insert, &hash_pop, &hash_size,
+    &hash_for_each, NULL, &hash_destroy,
+};
+
+static const KeyspaceOps k_slots_ops = {
+    "slots", &hash_lookup, &hash_insert, &hash_pop, &hash_size,
+    &hash_for_each, NULL, &hash_destroy,
+};
+
+static bool is_hash(Keyspace *ks)
+{
+    return ks->ops == &k_hmap_ops || ks->ops == &k_slots_ops;
+}
+
+static Keyspace *hash_new(const KeyspaceOps *ops, size_t n_slots)
+{
+    KsHash *kh = new KsHash();
+    kh->n_slots = n_slots;
+
+    // every lookup reads the slot array, with huge pages it takes one TLB
+    // entry; the mapping is zero-filled like calloc()
+    if (hp_enabled() && n_slots > 1)
+    {
+        kh->slots = (EntryMap **)hp_alloc(n_slots * sizeof(EntryMap *));
+        kh->slots_on_hp = kh->slots != NULL;
+    }
+
+    if (!kh->slots)
+    {
+        kh->slots = (EntryMap **)calloc(n_slots, sizeof(EntryMap *));
+    }
+    if (!kh->slots)
+    {
+        abort();
+    }
+
+    kh->ks.ops = ops;
+    return &kh->ks;
+}
+
+// the adaptive radix tree, ordered
+
+struct KsArt
+{
+    Keyspace ks;
+    ArtTree tree;
+};
+
+static ArtTree *art_of(Keyspace *ks)
+{
+    return &((KsArt *)ks)->tree;
+}
+
+static void entry_key_of(void *val, const uint8_t **key, size_t *len)
+{
+    Entry *ent = (Entry *)val;
+
+    *key = (const uint8_t *)ent->key.data();
+    *len = ent->key.size();
+}
+
+static Entry *art_ks_lookup(Keyspace *ks, const std::string &key)
+{
+    return (Entry *)art_lookup(art_of(ks), (uint8_t *)key.data(), key.size());
+}
+
+static void art_ks_insert(Keyspace *ks, Entry *ent)
+{
+    (void)art_insert(art_of(ks), (uint8_t *)ent->key.data(), ent->key.size(), ent);
+}
+
+static Entry *art_ks_pop(Keyspace *ks, const std::string &key)
+{
+    return (Entry *)art_pop(art_of(ks), (uint8_t *)key.data(), key.size());
+}
+
+static size_t art_ks_size(Keyspace *ks)
+{
+    return art_of(ks)->size;
+}
+
+struct IterArg
+{
+    bool (*f)(Entry *, void *);
+    void *arg;
+};
+
+static bool art_ks_cb(void *val, void *arg)
+{
+    IterArg *it = (IterArg *)arg;
+
+    return it->f((Entry *)val, it->arg);
+}
+
+static void art_ks_iter_from(Keyspace *ks, const std::string &start,
+                             bool (*f)(Entry *, void *), void *arg)
+{
+    IterArg it = {f, arg};
+    art_iter_from(art_of(ks), (uint8_t *)start.data(), start.size(), &art_ks_cb, &it);
+}
+
+static void art_ks_for_each(Keyspace *ks, bool (*f)(Entry *, void *), void *arg)
+{
+    art_ks_iter_from(ks, std::string(), f, arg);
+}
+
+static void art_ks_destroy(Keyspace *ks)
+{
+    art_destroy(art_of(ks));
+    delete (KsArt *)ks;
+}
+
+static const KeyspaceOps k_art_ops = {
+    "art", &art_ks_lookup, &art_ks_insert, &art_ks_pop, &art_ks_size,
+    &art_ks_for_each, &art_ks_iter_from, &art_ks_destroy,
+};
+
+// std::map, the balanced tree from the earlier chapters, ordered
+
+struct KsMap
+{
+    Keyspace ks;
+    std::map<std::string, Entry *> map;
+};
+
+static std::map<std::string, Entry *> &map_of(Keyspace *ks)
+{
+    return ((KsMap *)ks)->map;
+}
+
+static Entry *map_lookup(Keyspace *ks, const std::string &key)
+{
+    auto it = map_of(ks).find(key);
+
+    return it == map_of(ks).end() ? NULL : it->second;
+}
+
+static void map_insert(Keyspace *ks, Entry *ent)
+{
+    map_of(ks)[ent->key] = ent;
+}
+
+static Entry *map_pop(Keyspace *ks, const std::string &key)
+{
+    auto it = map_of(ks).find(key);
+
+    if (it == map_of(ks).end())
+    {
+        return NULL;
+    }
+
+    Entry *ent = it->second;
+    map_of(ks).erase(it);
+
+    return ent;
+}
+
+static size_t map_size(Keyspace *ks)
+{
+    return map_of(ks).size();
+}
+
+static void map_iter_from(Keyspace *ks, const std::string &start,
+                          bool (*f)(Entry *, void *), void *arg)
+{
+    for (auto it = map_of(ks).lower_bound(start); it != map_of(ks).end(); ++it)
+    {
+        if (!f(it->second, arg))
+        {
+            return;
+        }
+    }
+}
+
+static void map_for_each(Keyspace *ks, bool (*f)(Entry *, void *), void *arg)
+{
+    map_iter_from(ks, std::string(), f, arg);
+}
+
+static void map_destroy(Keyspace *ks)
+{
+    delete (KsMap *)ks;
+}
+
+static const KeyspaceOps k_map_ops = {
+    "map", &map_lookup, &map_insert, &map_pop, &map_size,
+    &map_for_each, &map_iter_from, &map_destroy,
+};
+
+Keyspace *ks_new(const char *name)
+{
+    Keyspace *ks = NULL;
+
+    if (0 == strcmp(name, k_hmap_ops.name))
+    {
+        ks = hash_new(&k_hmap_ops, 1);
+    }
+    else if (0 == strcmp(name, k_slots_ops.name))
+    {
+        ks = hash_new(&k_slots_ops, k_ks_slots);
+    }
+    else if (0 == strcmp(name, k_art_ops.name))
+    {
+        KsArt *ka = new KsArt();
+        ka->tree.key_of = &entry_key_of;
+        ks = &ka->ks;
+        ks->ops = &k_art_ops;
+    }
+    else if (0 == strcmp(name, k_map_ops.name))
+    {
+        ks = &(new KsMap())->ks;
+        ks->ops = &k_map_ops;
+    }
+
+    return ks;
+}
+
+size_t ks_n_slots(Keyspace *ks)
+{
+    return is_hash(ks) ? hash_of(ks)->n_slots : 0;
+}
+
+size_t ks_key_slot(Keyspace *ks, const std::string &key)
+{
+    assert(is_hash(ks));
+
+    return hash_slot(hash_of(ks), str_hash((uint8_t *)key.data(), key.size()));
+}
+
+EntryMap *ks_slot(Keyspace *ks, size_t slot)
+{
+    assert(is_hash(ks) && slot < hash_of(ks)->n_slots);
+
+    return hash_of(ks)->slots[slot];
+}
+
+EntryMap *ks_slot_detach(Keyspace *ks, size_t slot)
+{
+    KsHash *kh = hash_of(ks);
+    assert(is_hash(ks) && slot < kh->n_slots);
+
+    EntryMap *db = kh->slots[slot];
+    if (db)
+    {
+        hash_retire_stats(kh, db);
+        kh->size -= db->size();
+        kh->slots[slot] = NULL;
+    }
+
+    return db;
+}
+
+KsLookupStats ks_lookup_stats(Keyspace *ks)
+{
+    assert(is_hash(ks));
+
+    return hash_of(ks)->stats;
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+#include "hashtable.h"
+#include "thashtable.h"
+#include "slab.h"
+#include "logstore.h"
+
+const uint32_t k_no_ttl = (uint32_t)-1;
+
+// the structure for the key
+struct Entry
+{
+    struct HNode node;
+    std::string key;
+    SlabString value;
+    LogRec *log = NULL; // the value is in the log instead, with `--log-values`
+    uint32_t access = 0; // the LRU clock or the LFU counter, see evict.h
+    uint32_t heap_idx = k_no_ttl; // the position in the TTL heap
+};
+
+struct EntryKey
+{
+    const std::string &operator()(const Entry &ent) const
+    {
+        return ent.key;
+    }
+};
+
+struct KeyEq
+{
+    bool operator()(const std::string &lhs, const std::string &rhs) const
+    {
+        return lhs.size() == rhs.size() &&
+               0 == memcmp(lhs.data(), rhs.data(), lhs.size());
+    }
+};
+
+typedef THMap<Entry, &Entry::node, EntryKey, KeyEq> EntryMap;
+
+uint64_t str_hash(const uint8_t *data, size_t len);
+
+// A keyspace backend maps keys to Entries, the Entries are owned by the
+// caller. Backends without an order leave `iter_from` NULL.
+struct Keyspace;
+
+struct KeyspaceOps
+{
+    const char *name;
+    Entry *(*lookup)(Keyspace *ks, const std::string &key);
+    // the key must not exist
+    void (*insert)(Keyspace *ks, Entry *ent);
+    Entry *(*pop)(Keyspace *ks, const std::string &key);
+    size_t (*size)(Keyspace *ks);
+    // visit the entries until `f` returns false
+    void (*for_each)(Keyspace *ks, bool (*f)(Entry *, void *), void *arg);
+    // visit the entries in key order from the first key >= `start`
+    void (*iter_from)(Keyspace *ks, const std::string &start,
+                      bool (*f)(Entry *, void *), void *arg);
+    // frees the index, not the entries
+    void (*destroy)(Keyspace *ks);
+};
+
+struct Keyspace
+{
+    const KeyspaceOps *ops = NULL;
+};
+
+const size_t k_ks_slots = 16384; // slots of the "slots" backend
+
+// "hmap", "slots", "art" or "map", NULL for an unknown name
+Keyspace *ks_new(const char *name);
+
+// The hashtable backends split the keys into slots by hash, "hmap" has a
+// single slot. Returns 0 for other backends.
+size_t ks_n_slots(Keyspace *ks);
+
+size_t ks_key_slot(Keyspace *ks, const std::string &key);
+
+// the hashtable of a slot, NULL while the slot is empty
+EntryMap *ks_slot(Keyspace *ks, size_t slot);
+
+// remove a whole slot from the keyspace, the caller owns the hashtable
+EntryMap *ks_slot_detach(Keyspace *ks, size_t slot);
+
+struct KsLookupStats
+{
+    uint64_t n_lookups = 0;
+    uint64_t n_probes = 0;
+    uint64_t n_h2_hits = 0;
+};
+
+// The lookup counters that no slot's table holds: those of the tables
+// freed with their slot, and the lookups that found an empty slot.
+KsLookupStats ks_lookup_stats(Keyspace *ks);
+
+inline Entry *ks_lookup(Keyspace *ks, const std::string &key)
+{
+    return ks->ops->lookup(ks, key);
+}
+
+inline void ks_insert(Keyspace *ks, Entry *ent)
+{
+    ks->ops->insert(ks, ent);
+}
+
+inline Entry *ks_pop(Keyspace *ks, const std::string &key)
+{
+    return ks->ops->pop(ks, key);
+}
+
+inline size_t ks_size(Keyspace *ks)
+{
+    return ks->ops->size(ks);
+}
@@ -0,0 +1,176 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <new>
+#include <vector>
+#include "hugepage.h"
+#include "logstore.h"
+
+// the header at the start of each segment
+struct LogSeg
+{
+    size_t used = 0; // the bump pointer, from the start of the segment
+    size_t live = 0;
+};
+
+const size_t k_seg_header = (sizeof(LogSeg) + 7) & ~(size_t)7;
+
+static std::vector<LogSeg *> g_segs; // the last one is the head
+static size_t g_live = 0;
+static uint64_t g_n_cleaned = 0;
+static uint64_t g_moved = 0;
+
+static size_t rec_size(size_t len)
+{
+    return (sizeof(LogRec) + len + 7) & ~(size_t)7;
+}
+
+static LogSeg *seg_of(void *ptr)
+{
+    return (LogSeg *)((uintptr_t)ptr & ~(uintptr_t)(k_log_seg_size - 1));
+}
+
+// aligned, so that a record finds its segment with `seg_of()`
+static LogSeg *seg_new()
+{
+    void *ptr = map_aligned(k_log_seg_size, k_log_seg_size);
+    if (!ptr)
+    {
+        return NULL;
+    }
+
+    LogSeg *seg = new (ptr) LogSeg();
+    seg->used = k_seg_header;
+    g_segs.push_back(seg);
+
+    return seg;
+}
+
+size_t log_max_len()
+{
+    return k_log_seg_size - k_seg_header - sizeof(LogRec);
+}
+
+LogRec *log_append(const char *data, size_t len, LogRec **ref)
+{
+    if (len > log_max_len())
+    {
+        return NULL;
+    }
+
+    size_t size = rec_size(len);
+    LogSeg *seg = g_segs.empty() ? NULL : g_segs.back();
+
+    if (!seg || seg->used + size > k_log_seg_size)
+    {
+        if (!(seg = seg_new()))
+        {
+            return NULL;
+        }
+    }
+
+    LogRec *rec = new ((uint8_t *)seg + seg->used) LogRec();
+    rec->ref = ref;
+    rec->len = (uint32_t)len;
+    memcpy(rec->data(), data, len);
+
+    seg->used += size;
+    seg->live += size;
+    g_live += size;
+
+    return rec;
+}
+
+void log_free(LogRec *rec)
+{
+    assert(rec->ref);
+
+    size_t size = rec_size(rec->len);
+    rec->ref = NULL;
+    seg_of(rec)->live -= size;
+    g_live -= size;
+}
+
+void log_set_ref(LogRec *rec, LogRec **ref)
+{
+    rec->ref = ref;
+}
+
+double log_utilization()
+{
+    size_t mapped = g_segs.size() * k_log_seg_size;
+
+    return mapped ? (double)g_live / mapped : 1;
+}
+
+// copy the live records to the head, then unmap the segment
+static void seg_clean(size_t idx)
+{
+    LogSeg *seg = g_segs[idx];
+
+    // the copies must not land in the segment itself
+    g_segs.erase(g_segs.begin() + idx);
+
+    for (size_t pos = k_seg_header; pos < seg->used;)
+    {
+        LogRec *rec = (LogRec *)((uint8_t *)seg + pos);
+        pos += rec_size(rec->len);
+
+        if (!rec->ref)
+        {
+            continue;
+        }
+
+        LogRec *copy = log_append(rec->data(), rec->len, rec->ref);
+        if (!copy)
+        {
+            abort();
+        }
+
+        *rec->ref = copy;
+        g_live -= rec_size(rec->len);
+        g_moved += rec_size(rec->len);
+    }
+
+    munmap(seg, k_log_seg_size);
+    g_n_cleaned++;
+}
+
+size_t log_clean(double target, size_t max_segments)
+{
+    size_t n_cleaned = 0;
+
+    while (n_cleaned < max_segments && g_segs.size() > 1 && log_utilization() < target)
+    {
+        // the least utilized segment, except the head
+        size_t victim = 0;
+        for (size_t i = 1; i + 1 < g_segs.size(); ++i)
+        {
+            if (g_segs[i]->live < g_segs[victim]->live)
+            {
+                victim = i;
+            }
+        }
+
+        // a full segment gains nothing
+        if (g_segs[victim]->live + k_seg_header >= k_log_seg_size - k_log_seg_size / 64)
+        {
+            break;
+        }
+
+        seg_clean(victim);
+        n_cleaned++;
+    }
+
+    return n_cleaned;
+}
+
+void log_stats(LogStats *stats)
+{
+    stats->n_segments = g_segs.size();
+    stats->mapped_bytes = g_segs.size() * k_log_seg_size;
+    stats->live_bytes = g_live;
+    stats->n_cleaned = g_n_cleaned;
+    stats->moved_bytes = g_moved;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Log-structured storage for values.
+//
+// Records are appended to 1 MiB segments with a pointer bump, a freed
+// record is only marked dead. The cleaner copies the live records of the
+// least utilized segments to the head and unmaps them. Each record knows
+// the pointer that refers to it, so the cleaner can update the owner.
+
+const size_t k_log_seg_size = 1 << 20;
+
+struct LogRec
+{
+    LogRec **ref = NULL; // the owner's pointer to this record, NULL if dead
+    uint32_t len = 0;
+    // followed by `len` bytes of data
+
+    char *data()
+    {
+        return (char *)(this + 1);
+    }
+};
+
+struct LogStats
+{
+    size_t n_segments = 0;
+    size_t mapped_bytes = 0;
+    size_t live_bytes = 0; // including the record headers
+    uint64_t n_cleaned = 0; // segments
+    uint64_t moved_bytes = 0;
+};
+
+// the largest value that fits in a segment
+size_t log_max_len();
+
+// NULL if the data is too big or out of memory
+LogRec *log_append(const char *data, size_t len, LogRec **ref);
+
+void log_free(LogRec *rec);
+
+// the owner's pointer has moved
+void log_set_ref(LogRec *rec, LogRec **ref);
+
+// live bytes / mapped bytes, 1 for an empty log
+double log_utilization();
+
+// Compact the least utilized segments while the utilization is below
+// `target`, for at most `max_segments`. Returns the segments cleaned.
+size_t log_clean(double target, size_t max_segments);
+
+void log_stats(LogStats *stats);
@@ -1,24 +1,66 @@
-// Compile w/ [g++ -Wall -Wextra -O2 -g server.cpp -o server]
+// Compile w/ [g++ -Wall -Wextra -O2 -g server.cpp keyspace.cpp hashtable.cpp art.cpp hugepage.cpp slab.cpp logstore.cpp evict.cpp tinylfu.cpp heap.cpp timerwheel.cpp epoch.cpp -o server]
 
 #include <assert.h>
+#include <sched.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <ctype.h>
+#include <time.h>
 #include <fcntl.h>
 #include <poll.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <linux/sockios.h>
 #include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <new>
+#include <algorithm>
 #include <string>
 #include <vector>
 
 #include "hashtable.h"
+#include "hugepage.h"
+#include "slab.h"
+#include "logstore.h"
+#include "evict.h"
+#include "tinylfu.h"
+#include "heap.h"
+#include "timerwheel.h"
+#include "epoch.h"
+#include "keyspace.h"
 
 const size_t k_max_msg = 4096;  // 4 Kib
 const size_t k_max_args = 1024; // 1 Kib
+// set in the argument count when a deadline follows it: 8 bytes of
+// microseconds since the Unix epoch
+const uint32_t k_req_deadline = 1u << 31;
+const int64_t k_scan_count = 10;     // default COUNT of SCAN
+const size_t k_stats_samples = 4096; // buckets sampled by DEBUG HTSTATS
+
+// active defrag
+const uint64_t k_defrag_budget_usec = 1000;      // per event loop iteration
+const uint64_t k_defrag_interval_usec = 1000000; // between passes
+const size_t k_defrag_min_bytes = 4 << 20;       // ignore small heaps
+const size_t k_defrag_min_frag = 110;            // mapped / used, in percent
+
+// log-structured values
+const double k_log_target = 0.9; // the utilization kept by the cleaner
+const size_t k_log_clean_max = 4; // segments per event loop iteration
+
+const size_t k_evict_max_keys = 64; // evictions per write, to bound the latency
+
+const uint64_t k_expire_budget_usec = 1000; // active expiry per event loop iteration
+
+const uint64_t k_idle_timeout_ms = 300 * 1000; // default of `--idle-timeout`
+const size_t k_conn_buf_size = 4 * (4 + k_max_msg); // pipelined requests or responses
+const size_t k_buf_pool_max = 256; // free connection buffers kept for reuse
+const uint32_t k_conn_budget = 32; // requests per connection per event loop iteration
+const uint64_t k_admin_check_usec = 100; // between checks of the priority lane
 
 #define container_of(ptr, type, member) ({                  \
     const typeof( ((type *)0)->member ) *__m_ptr = (ptr);    \
@@ -45,42 +87,128 @@ enum
     SER_STR = 2, // A string
     SER_INT = 3, // A int64
     SER_ARR = 4, // Array
+    SER_DBL = 5, // A double
 };
 
 enum
 {
     ERR_UNKNOWN = 1,
     ERR_2BIG = 2,
+    ERR_ARG = 3,
+    ERR_ENGINE = 4, // not supported by the keyspace engine
+    ERR_OOM = 5,    // over `maxmemory` and nothing to evict
+    ERR_BUSY = 6,   // shed under load, retry elsewhere
+    ERR_DEADLINE = 7, // the deadline of the request has passed
 };
 
+
 struct Conn
 {
     int fd = -1;
     uint32_t state = 0; // either [STATE_REQ] or [STATE_RES]
-
-    // buffer for reading
+    uint32_t budget = 0; // requests left in this event loop iteration
+    bool ready = false;  // has work left over from the last iteration
+    bool admin = false;  // from the admin port, served first
+    uint64_t ready_usec = 0; // when it was deferred
+
+    // buffer for reading, from the pool while it holds data;
+    // the requests before `r_buf_pos` are consumed
+    uint8_t *r_buf = NULL;
     size_t r_buf_size = 0;
-    uint8_t r_buf[4 + k_max_msg];
+    size_t r_buf_pos = 0;
 
-    // buffer for writing
+    // buffer for writing, from the pool until the response is sent
+    uint8_t *w_buf = NULL;
     size_t w_buf_size = 0;
     size_t w_buf_sent = 0;
-    uint8_t w_buf[4 + k_max_msg];
+
+    // re-armed on every IO, closes the connection when it fires
+    TimerNode idle_timer;
+    // armed while the unsent output is over the soft limit
+    TimerNode output_timer;
 };
 
+// the pending output of a client, 0 for no limit
+struct OutputLimit
+{
+    size_t hard_bytes = 0; // disconnect as soon as it is exceeded
+    size_t soft_bytes = 0; // disconnect if exceeded for `soft_secs`
+    uint64_t soft_secs = 0;
+};
+
+// the client connections
+static struct
+{
+    size_t n_conns = 0;
+    uint64_t idle_timeout_ms = k_idle_timeout_ms; // 0 for none
+    uint64_t n_idle_closed = 0;
+    OutputLimit output_limit;
+    uint64_t n_output_closed = 0;
+    TimerWheel timers;
+    // `k_conn_buf_size` buffers shared by the connections with data in flight
+    std::vector<uint8_t *> free_bufs;
+    size_t n_bufs_used = 0;
+    // the connections that ran out of budget, served again without waiting for IO
+    size_t n_ready = 0;
+    uint64_t n_deferred = 0;
+    // the priority lane, 0 for no admin port
+    uint16_t admin_port = 0;
+    uint64_t n_admin_checks = 0;
+    // the event loop lag: from readiness to serving a connection
+    uint64_t poll_usec = 0;     // when the last poll() returned
+    uint64_t max_lag_usec = 0;  // in the current iteration
+    uint64_t lag_usec = 0;      // in the last iteration
+    uint64_t shed_lag_usec = 0; // shed load above it, 0 for never
+    bool shedding = false;
+    uint64_t n_shed_writes = 0;
+    uint64_t n_shed_conns = 0;
+    uint64_t n_deadline_exceeded = 0;
+} g_conns;
+
+// the low-latency mode: spin on readiness checks before blocking in poll()
+static struct
+{
+    uint64_t spin_usec = 0; // per wait, 0 to block right away
+    int cpu = -1;           // the core the loop is pinned to
+    uint64_t n_spin_hits = 0;  // events found while spinning
+    uint64_t idle_spin_usec = 0;
+    uint64_t work_usec = 0; // from poll() returning to the next wait
+} g_busy;
+
 // the data structure for the key space
 static struct
 {
-    HMap db;
+    Keyspace *ks = NULL;
+    // entries come from the slabs, or from huge page regions with `--hugepages`
+    HPPool entry_pool;
+    // values are appended to the log instead of the slabs
+    bool log_values = false;
+    bool log_cleaning = false; // the last cleaner step made progress
+    // `maxmemory`, 0 for no limit
+    size_t maxmemory = 0;
+    int evict_policy = EVICT_NONE;
+    size_t mem_used = 0; // an estimate, see `entry_mem()`
+    uint64_t n_evicted = 0;
+    EvictPool evict_pool;
+    // W-TinyLFU admission in front of the eviction policy
+    bool admission = false;
+    TinyLfu tlfu;
+    // the expiration times in milliseconds, the earliest first
+    std::vector<HeapItem> heap;
+    uint64_t n_expired = 0;
 } g_data;
 
-// the structure for the key
-struct Entry
+// the progress of the active defrag, a pass walks all buckets of all slots
+static struct
 {
-    struct HNode node;
-    std::string key;
-    std::string value;
-};
+    bool enabled = false;
+    bool active = false; // in a pass
+    size_t slot = 0;
+    size_t pos = 0; // bucket position in [h1] then [h2]
+    uint64_t last_pass_usec = 0; // or the last check that found no need
+    uint64_t n_moved = 0;
+    uint64_t n_passes = 0;
+} g_defrag;
 
 static void msg(const char *msg)
 {
@@ -95,7 +223,7 @@ static void die(const char *msg)
 }
 
 static int32_t parse_req(
-    const uint8_t *data, size_t len, std::vector<std::string> &out)
+    const uint8_t *data, size_t len, std::vector<std::string> &out, uint64_t &deadline)
 {
     if (len < 4)
     {
@@ -106,12 +234,27 @@ static int32_t parse_req(
 
     memcpy(&s, &data[0], 4);
 
+    size_t pos = 4;
+
+    // the optional deadline
+    deadline = 0;
+    if (s & k_req_deadline)
+    {
+        if (pos + 8 > len)
+        {
+            return -1;
+        }
+
+        memcpy(&deadline, &data[pos], 8);
+        pos += 8;
+        s &= ~k_req_deadline;
+    }
+
     if (s > k_max_args)
     {
         return -1;
     }
 
-    size_t pos = 4;
     while (s--)
     {
         if (pos + 4 > len)
@@ -140,37 +283,22 @@ static int32_t parse_req(
     return 0;
 }
 
-static bool entry_eq(HNode *lhs, HNode *rhs)
-{
-    struct Entry *le = container_of(lhs, struct Entry, node);
-    struct Entry *re = container_of(rhs, struct Entry, node);
-
-    return le->key == re->key;
-}
-
-static uint64_t str_hash(const uint8_t *data, size_t len)
-{
-    uint32_t h = 0x811C9DC5;
-
-    for (size_t i = 0; i < len; i++)
-    {
-        h = (h + data[i]) * 0x01000193;
-    }
-
-    return h;
-}
-
 static void out_nil(std::string &out)
 {
     out.push_back(SER_NIL);
 }
 
-static void out_str(std::string &out, const std::string &val)
+static void out_str(std::string &out, const char *data, size_t size)
 {
     out.push_back(SER_STR);
-    uint32_t len = (uint32_t)val.size();
+    uint32_t len = (uint32_t)size;
     out.append((char *)&len, 4);
-    out.append(val);
+    out.append(data, size);
+}
+
+static void out_str(std::string &out, const std::string &val)
+{
+    out_str(out, val.data(), val.size());
 }
 
 static void out_int(std::string &out, int64_t val)
@@ -179,6 +307,12 @@ static void out_int(std::string &out, int64_t val)
     out.append((char *)&val, 8);
 }
 
+static void out_dbl(std::string &out, double val)
+{
+    out.push_back(SER_DBL);
+    out.append((char *)&val, 8);
+}
+
 static void out_err(std::string &out, int32_t code, const std::string &msg)
 {
     out.push_back(SER_ERR);
@@ -194,162 +328,1473 @@ static void out_arr(std::string &out, uint32_t n)
     out.append((char *)&n, 4);
 }
 
-static void do_get(std::vector<std::string> &cmd, std::string &out)
+static bool cmd_is(const std::string &word, const char *cmd)
+{
+    return 0 == strcasecmp(word.c_str(), cmd);
+}
+
+static bool str2int(const std::string &s, int64_t &out)
+{
+    char *endp = NULL;
+    out = strtoll(s.c_str(), &endp, 10);
+
+    return !s.empty() && endp == s.c_str() + s.size();
+}
+
+static uint64_t get_monotonic_usec()
+{
+    timespec tv = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+
+    return uint64_t(tv.tv_sec) * 1000000 + tv.tv_nsec / 1000;
+}
+
+// the clock of request deadlines
+static uint64_t get_realtime_usec()
+{
+    timespec tv = {0, 0};
+    clock_gettime(CLOCK_REALTIME, &tv);
+
+    return uint64_t(tv.tv_sec) * 1000000 + tv.tv_nsec / 1000;
+}
+
+static size_t get_rss_bytes()
 {
+    long pages = 0, rss = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
 
-    Entry key;
-    key.key.swap(cmd[1]);
-    key.node.h_code = str_hash((uint8_t *)key.key.data(), key.key.size());
+    if (fp)
+    {
+        if (2 != fscanf(fp, "%ld %ld", &pages, &rss))
+        {
+            rss = 0;
+        }
+        fclose(fp);
+    }
 
-    HNode *node = hm_lookup(&g_data.db, &key.node, &entry_eq);
+    return (size_t)rss * (size_t)sysconf(_SC_PAGESIZE);
+}
 
-    if (!node)
+static Entry *entry_new()
+{
+    void *ptr = hp_enabled() ? hp_pool_alloc(&g_data.entry_pool)
+                             : slab_alloc(sizeof(Entry));
+    if (!ptr)
     {
-        return out_nil(out);
+        die("out of memory");
     }
 
-    const std::string &val = container_of(node, Entry, node)->value;
-    out_str(out, val);
+    return new (ptr) Entry();
 }
 
-static void do_set(std::vector<std::string> &cmd, std::string &out)
+static void entry_del(Entry *ent)
 {
-    Entry key;
-    key.key.swap(cmd[1]);
-    key.node.h_code = str_hash((uint8_t *)key.key.data(), key.key.size());
+    if (ent->log)
+    {
+        log_free(ent->log);
+    }
 
-    HNode *node = hm_lookup(&g_data.db, &key.node, &entry_eq);
-    if (node)
+    ent->~Entry();
+
+    if (hp_enabled())
     {
-        container_of(node, Entry, node)->value.swap(cmd[2]);
+        hp_pool_free(&g_data.entry_pool, ent);
     }
     else
     {
-        Entry *ent = new Entry();
-        ent->key.swap(key.key);
-        ent->node.h_code = key.node.h_code;
-        ent->value.swap(cmd[2]);
-        hm_insert(&g_data.db, &ent->node);
+        slab_free(ent, sizeof(Entry));
     }
-    return out_nil(out);
 }
 
-static void do_del(std::vector<std::string> &cmd, std::string &out)
+static void entry_free(void *ptr)
+{
+    entry_del((Entry *)ptr);
+}
+
+static void str_free(void *ptr)
+{
+    delete (SlabString *)ptr;
+}
+
+// the memory of an entry, its key and its value
+static size_t entry_mem(Entry *ent)
+{
+    size_t val = ent->log ? sizeof(LogRec) + ent->log->len : ent->value.size();
+
+    return sizeof(Entry) + ent->key.size() + val;
+}
+
+static uint64_t get_monotonic_msec()
+{
+    return get_monotonic_usec() / 1000;
+}
+
+static void heap_delete(std::vector<HeapItem> &a, size_t pos)
+{
+    // swap the erased item with the last item
+    a[pos] = a.back();
+    a.pop_back();
+
+    // update the swapped item
+    if (pos < a.size())
+    {
+        heap_update(a.data(), pos, a.size());
+    }
+}
+
+static void heap_upsert(std::vector<HeapItem> &a, size_t pos, HeapItem t)
+{
+    if (pos < a.size())
+    {
+        a[pos] = t; // update an existing item
+    }
+    else
+    {
+        pos = a.size();
+        a.push_back(t); // or add a new item
+    }
+
+    heap_update(a.data(), pos, a.size());
+}
+
+// set or remove the TTL, a negative TTL removes it
+static void entry_set_ttl(Entry *ent, int64_t ttl_ms)
+{
+    if (ttl_ms < 0 && ent->heap_idx != k_no_ttl)
+    {
+        heap_delete(g_data.heap, ent->heap_idx);
+        ent->heap_idx = k_no_ttl;
+    }
+    else if (ttl_ms >= 0)
+    {
+        // clamped, so that the remaining TTL fits an int64
+        uint64_t now = get_monotonic_msec();
+        HeapItem item;
+        item.val = now + (uint64_t)std::min<int64_t>(ttl_ms, INT64_MAX - (int64_t)now);
+        item.ref = &ent->heap_idx;
+        heap_upsert(g_data.heap, ent->heap_idx, item);
+    }
+}
+
+static bool entry_expired(Entry *ent)
+{
+    return ent->heap_idx != k_no_ttl &&
+           g_data.heap[ent->heap_idx].val <= get_monotonic_msec();
+}
+
+// unlink from the TTL heap and the memory accounting,
+// then free it when no reader can see it
+static void entry_retire(Entry *ent)
 {
-    Entry key;
-    key.key.swap(cmd[1]);
-    key.node.h_code = str_hash((uint8_t *)key.key.data(), key.key.size());
+    entry_set_ttl(ent, -1);
+    g_data.mem_used -= entry_mem(ent);
+    epoch_retire(ent, &entry_free);
+}
 
-    HNode *node = hm_pop(&g_data.db, &key.node, &entry_eq);
+// a lookup that removes the key if it has expired
+static Entry *entry_lookup(const std::string &key)
+{
+    Entry *ent = ks_lookup(g_data.ks, key);
 
-    if (node)
+    if (ent && entry_expired(ent))
     {
-        delete container_of(node, Entry, node);
+        (void)ks_pop(g_data.ks, key);
+        entry_retire(ent);
+        g_data.n_expired++;
+        return NULL;
     }
 
-    return out_int(out, node ? 1 : 0);
+    return ent;
+}
+
+// for the `volatile-*` policies
+static bool entry_has_ttl(Entry *ent)
+{
+    return ent->heap_idx != k_no_ttl;
 }
 
-static void h_scan(HTab *tab, void (*f)(HNode *, void *), void *arg)
+// a random key with a TTL, the volatile policies sample the TTL heap
+// instead of searching the keyspace for them
+static Entry *entry_sample_ttl()
 {
-    if (tab->size == 0)
+    std::vector<HeapItem> &heap = g_data.heap;
+
+    if (heap.empty())
     {
-        return;
+        return NULL;
     }
 
-    for (size_t i = 0; i < tab->mask + 1; ++i)
+    return container_of(heap[(size_t)rand() % heap.size()].ref, Entry, heap_idx);
+}
+
+// the admission window's copies of the keys count as used memory
+static void admission_account(size_t before)
+{
+    g_data.mem_used = g_data.mem_used - before + g_data.tlfu.window_bytes;
+}
+
+// Evict until the used memory is under `maxmemory`, with a bounded
+// number of evictions per call. False if it is over the limit and there
+// is nothing to evict.
+static bool evict_for_write()
+{
+    size_t n_evicted = 0;
+
+    while (g_data.maxmemory && g_data.mem_used > g_data.maxmemory)
     {
-        HNode *node = tab->tab[i];
+        if (g_data.evict_policy == EVICT_NONE)
+        {
+            return false;
+        }
+
+        if (n_evicted == k_evict_max_keys)
+        {
+            return true; // continue on the next write
+        }
+
+        bool is_volatile = g_data.evict_policy == EVICT_VOLATILE_LRU ||
+                           g_data.evict_policy == EVICT_VOLATILE_LFU;
+
+        if (is_volatile && g_data.heap.empty())
+        {
+            return n_evicted > 0; // no key has a TTL
+        }
+
+        EvictPool *pool = &g_data.evict_pool;
+        EvictScope volatile_keys;
+        volatile_keys.eligible = &entry_has_ttl;
+        volatile_keys.sample = &entry_sample_ttl;
+        const EvictScope *scope = is_volatile ? &volatile_keys : NULL;
+        std::string key;
+        Entry *ent = NULL;
+
+        if (g_data.admission)
+        {
+            size_t before = g_data.tlfu.window_bytes;
+            if (tlfu_pick_victim(&g_data.tlfu, g_data.ks, pool, g_data.evict_policy,
+                                 scope, key))
+            {
+                ent = ks_pop(g_data.ks, key);
+            }
+            admission_account(before);
+        }
+        else
+        {
+            // candidates may be gone already, and crowd out the fresh
+            // samples, so refill once when none of them is left
+            for (int fill = 0; !ent && fill < 2; ++fill)
+            {
+                evict_pool_fill(pool, g_data.ks, g_data.evict_policy, scope);
+
+                while (!ent && evict_pool_pop(pool, key))
+                {
+                    ent = ks_pop(g_data.ks, key);
+                }
+            }
+        }
 
-        while (node)
+        if (!ent)
         {
-            f(node, arg);
-            node = node->next;
+            return n_evicted > 0;
         }
+
+        entry_retire(ent);
+        g_data.n_evicted++;
+        n_evicted++;
     }
+
+    return true;
 }
 
-static void cb_scan(HNode *node, void *arg)
+static void out_value(std::string &out, Entry *ent)
 {
-    std::string &out = *(std::string *)arg;
-
-    out_str(out, container_of(node, Entry, node)->key);
+    if (ent->log)
+    {
+        out_str(out, ent->log->data(), ent->log->len);
+    }
+    else
+    {
+        out_str(out, ent->value.data(), ent->value.size());
+    }
 }
 
-static void do_keys(std::vector<std::string> &cmd, std::string &out)
+static void entry_set_value(Entry *ent, const std::string &val)
 {
-    (void)cmd;
+    if (g_data.log_values)
+    {
+        // a pointer bump, the old record stays readable until it is
+        // cleaned, which never happens inside a critical section
+        LogRec *rec = log_append(val.data(), val.size(), &ent->log);
+        if (!rec)
+        {
+            die("out of memory");
+        }
 
-    out_arr(out, (uint32_t)hm_size(&g_data.db));
+        if (ent->log)
+        {
+            log_free(ent->log);
+        }
+        ent->log = rec;
+        return;
+    }
 
-    h_scan(&g_data.db.h1, &cb_scan, &out);
-    h_scan(&g_data.db.h2, &cb_scan, &out);
+    SlabString old(val.data(), val.size());
+    ent->value.swap(old);
+
+    // the old value is freed once no reader can see it, only the
+    // heap buffer matters, short strings live inside the Entry
+    if (old.capacity() > SlabString().capacity())
+    {
+        epoch_retire(new SlabString(std::move(old)), &str_free);
+    }
 }
 
-static bool cmd_is(const std::string &word, const char *cmd)
+// count an access in the admission sketch, hit or miss
+static void admission_record(const std::string &key)
 {
-    return 0 == strcasecmp(word.c_str(), cmd);
+    if (g_data.admission)
+    {
+        tlfu_record(&g_data.tlfu, str_hash((uint8_t *)key.data(), key.size()));
+    }
 }
 
-static void do_request(std::vector<std::string> &cmd, std::string &out)
+static void do_get(std::vector<std::string> &cmd, std::string &out)
 {
-    if (cmd.size() == 1 && cmd_is(cmd[0], "keys"))
+    admission_record(cmd[1]);
+
+    Entry *ent = entry_lookup(cmd[1]);
+
+    if (!ent)
     {
-        do_keys(cmd, out);
+        return out_nil(out);
     }
-    else if (cmd.size() == 2 && cmd_is(cmd[0], "get"))
+
+    evict_touch(ent, g_data.evict_policy);
+    out_value(out, ent);
+}
+
+// set key value [EX seconds | PX milliseconds]
+//
+// An overwrite without EX or PX removes the TTL.
+static void do_set(std::vector<std::string> &cmd, std::string &out)
+{
+    int64_t ttl_ms = -1;
+
+    if (cmd.size() == 5)
     {
-        do_get(cmd, out);
+        int64_t n = 0;
+        if (!str2int(cmd[4], n) || n <= 0)
+        {
+            return out_err(out, ERR_ARG, "expect a positive TTL");
+        }
+
+        if (cmd_is(cmd[3], "ex"))
+        {
+            if (n > INT64_MAX / 1000)
+            {
+                return out_err(out, ERR_ARG, "TTL out of range");
+            }
+            ttl_ms = n * 1000;
+        }
+        else if (cmd_is(cmd[3], "px"))
+        {
+            ttl_ms = n;
+        }
+        else
+        {
+            return out_err(out, ERR_ARG, "expect EX or PX");
+        }
     }
-    else if (cmd.size() == 3 && cmd_is(cmd[0], "set"))
+
+    if (!evict_for_write())
     {
-        do_set(cmd, out);
+        return out_err(out, ERR_OOM, "used memory is over maxmemory");
     }
-    else if (cmd.size() == 2 && cmd_is(cmd[0], "del"))
+
+    admission_record(cmd[1]);
+
+    Entry *ent = entry_lookup(cmd[1]);
+    if (ent)
     {
-        do_del(cmd, out);
+        g_data.mem_used -= entry_mem(ent);
+        entry_set_value(ent, cmd[2]);
+        evict_touch(ent, g_data.evict_policy);
     }
     else
     {
-        // cmd is not recognized
-        out_err(out, ERR_UNKNOWN, "Unknown cmd");
+        ent = entry_new();
+        ent->key.swap(cmd[1]);
+        entry_set_value(ent, cmd[2]);
+        evict_init(ent, g_data.evict_policy);
+        ks_insert(g_data.ks, ent);
+
+        if (g_data.admission)
+        {
+            size_t before = g_data.tlfu.window_bytes;
+            tlfu_window_push(&g_data.tlfu, g_data.ks, ent->key);
+            admission_account(before);
+        }
     }
+
+    entry_set_ttl(ent, ttl_ms);
+    g_data.mem_used += entry_mem(ent);
+    return out_nil(out);
 }
 
-static void fd_set_nb(int fd)
+static void do_del(std::vector<std::string> &cmd, std::string &out)
 {
-    errno = 0;
-    int flags = fcntl(fd, F_GETFL, 0);
+    Entry *ent = ks_pop(g_data.ks, cmd[1]);
+    bool expired = ent && entry_expired(ent);
 
-    if (errno)
+    if (ent)
     {
-        die("fcntl() error");
-        return;
+        entry_retire(ent);
     }
 
-    flags |= O_NONBLOCK;
+    if (expired)
+    {
+        g_data.n_expired++;
+    }
 
-    errno = 0;
+    return out_int(out, ent && !expired ? 1 : 0);
+}
 
-    (void)fcntl(fd, F_SETFL, flags);
+// expire key seconds, pexpire key milliseconds
+//
+// Returns 1 if the TTL is set, a TTL <= 0 deletes the key.
+static void do_expire(std::vector<std::string> &cmd, std::string &out)
+{
+    int64_t ttl = 0;
+    if (!str2int(cmd[2], ttl))
+    {
+        return out_err(out, ERR_ARG, "expect an int64");
+    }
+
+    Entry *ent = entry_lookup(cmd[1]);
+    if (!ent)
+    {
+        return out_int(out, 0);
+    }
+
+    bool in_secs = cmd_is(cmd[0], "expire");
+    if (in_secs && ttl > INT64_MAX / 1000)
+    {
+        return out_err(out, ERR_ARG, "TTL out of range");
+    }
+
+    if (ttl <= 0)
+    {
+        (void)ks_pop(g_data.ks, cmd[1]);
+        entry_retire(ent);
+        return out_int(out, 1);
+    }
+
+    entry_set_ttl(ent, in_secs ? ttl * 1000 : ttl);
+    return out_int(out, 1);
+}
+
+// ttl key, pttl key
+//
+// The remaining TTL, -2 for a missing key and -1 for a key without a TTL.
+static void do_ttl(std::vector<std::string> &cmd, std::string &out)
+{
+    Entry *ent = entry_lookup(cmd[1]);
+    if (!ent)
+    {
+        return out_int(out, -2);
+    }
+
+    if (ent->heap_idx == k_no_ttl)
+    {
+        return out_int(out, -1);
+    }
+
+    int64_t ttl_ms = (int64_t)(g_data.heap[ent->heap_idx].val - get_monotonic_msec());
+    return out_int(out, cmd_is(cmd[0], "ttl") ? ttl_ms / 1000 + (ttl_ms % 1000 >= 500) : ttl_ms);
+}
+
+// persist key
+//
+// Returns 1 if the TTL was removed.
+static void do_persist(std::vector<std::string> &cmd, std::string &out)
+{
+    Entry *ent = entry_lookup(cmd[1]);
+    if (!ent || ent->heap_idx == k_no_ttl)
+    {
+        return out_int(out, 0);
+    }
+
+    entry_set_ttl(ent, -1);
+    return out_int(out, 1);
+}
+
+struct ScanResult
+{
+    std::string keys;
+    uint32_t n_keys = 0;
+    // for ordered scans
+    int64_t limit = 0;
+    std::string prefix;
+    std::string end; // exclusive, empty for no end
+};
+
+static void out_scan_keys(std::string &out, ScanResult &res)
+{
+    out_arr(out, res.n_keys);
+    out.append(res.keys);
+}
+
+// expired keys are skipped by the iterations, but not removed, as that
+// would change the table being iterated
+static bool cb_keys(Entry *ent, void *arg)
+{
+    ScanResult &res = *(ScanResult *)arg;
+
+    if (!entry_expired(ent))
+    {
+        out_str(res.keys, ent->key);
+        res.n_keys++;
+    }
+    return true;
+}
+
+static void do_keys(std::vector<std::string> &cmd, std::string &out)
+{
+    (void)cmd;
+
+    ScanResult res;
+    g_data.ks->ops->for_each(g_data.ks, &cb_keys, &res);
+    out_scan_keys(out, res);
+}
+
+static void out_info(std::string &out, const char *name, int64_t val)
+{
+    out_str(out, name);
+    out_int(out, val);
+}
+
+// server statistics as an array of name/value pairs
+static void do_info(std::vector<std::string> &cmd, std::string &out)
+{
+    (void)cmd;
+
+    EpochStats epoch;
+    epoch_stats(&epoch);
+
+    SlabStats slabs[k_slab_classes];
+    slab_stats(slabs);
+
+    size_t slab_used = 0;
+    for (SlabStats &st : slabs)
+    {
+        slab_used += st.n_used * st.obj_size;
+    }
+
+    LogStats log;
+    log_stats(&log);
+
+    out_arr(out, 2 * 39);
+    out_str(out, "engine");
+    out_str(out, g_data.ks->ops->name);
+    out_info(out, "keys", (int64_t)ks_size(g_data.ks));
+    out_info(out, "hugepages_enabled", hp_enabled());
+    out_info(out, "hugepage_bytes", (int64_t)hp_backed_bytes());
+    out_info(out, "slab_bytes", (int64_t)slab_mapped_bytes());
+    out_info(out, "slab_used_bytes", (int64_t)slab_used);
+    out_info(out, "defrag_moved", (int64_t)g_defrag.n_moved);
+    out_info(out, "defrag_passes", (int64_t)g_defrag.n_passes);
+    out_info(out, "log_segments", (int64_t)log.n_segments);
+    out_info(out, "log_bytes", (int64_t)log.mapped_bytes);
+    out_info(out, "log_live_bytes", (int64_t)log.live_bytes);
+    out_info(out, "log_cleaned", (int64_t)log.n_cleaned);
+    out_info(out, "used_memory", (int64_t)g_data.mem_used);
+    out_info(out, "maxmemory", (int64_t)g_data.maxmemory);
+    out_str(out, "maxmemory_policy");
+    out_str(out, evict_policy_name(g_data.evict_policy));
+    out_info(out, "evicted_keys", (int64_t)g_data.n_evicted);
+    out_info(out, "admission_admitted", (int64_t)g_data.tlfu.n_admitted);
+    out_info(out, "admission_rejected", (int64_t)g_data.tlfu.n_rejected);
+    out_info(out, "expires", (int64_t)g_data.heap.size());
+    out_info(out, "expired_keys", (int64_t)g_data.n_expired);
+    out_info(out, "epoch", (int64_t)epoch.epoch);
+    out_info(out, "epoch_backlog", (int64_t)epoch.backlog);
+    out_info(out, "epoch_retired", (int64_t)epoch.n_retired);
+    out_info(out, "epoch_freed", (int64_t)epoch.n_freed);
+    out_info(out, "connected_clients", (int64_t)g_conns.n_conns);
+    out_info(out, "idle_timeouts", (int64_t)g_conns.n_idle_closed);
+    out_info(out, "output_limit_disconnects", (int64_t)g_conns.n_output_closed);
+    out_info(out, "conn_buffers", (int64_t)g_conns.n_bufs_used);
+    out_info(out, "budget_deferrals", (int64_t)g_conns.n_deferred);
+    out_info(out, "admin_lane_checks", (int64_t)g_conns.n_admin_checks);
+    out_info(out, "loop_lag_usec", (int64_t)g_conns.lag_usec);
+    out_info(out, "shedding", g_conns.shedding);
+    out_info(out, "shed_writes", (int64_t)g_conns.n_shed_writes);
+    out_info(out, "shed_conns", (int64_t)g_conns.n_shed_conns);
+    out_info(out, "deadline_exceeded", (int64_t)g_conns.n_deadline_exceeded);
+    out_info(out, "busy_spin_hits", (int64_t)g_busy.n_spin_hits);
+    out_info(out, "busy_idle_spin_usec", (int64_t)g_busy.idle_spin_usec);
+    out_info(out, "busy_work_usec", (int64_t)g_busy.work_usec);
+    out_info(out, "rss_bytes", (int64_t)get_rss_bytes());
+}
+
+// debug slabstats
+//
+// One [size, slabs, used, capacity] array per slab size class.
+static void do_slabstats(std::vector<std::string> &cmd, std::string &out)
+{
+    (void)cmd;
+
+    SlabStats slabs[k_slab_classes];
+    slab_stats(slabs);
+
+    out_arr(out, k_slab_classes);
+    for (SlabStats &st : slabs)
+    {
+        out_arr(out, 4);
+        out_int(out, (int64_t)st.obj_size);
+        out_int(out, (int64_t)st.n_slabs);
+        out_int(out, (int64_t)st.n_used);
+        out_int(out, (int64_t)st.capacity);
+    }
+}
+
+// merge the stats of a table into `total`
+static void add_tab_stats(HTabStats &total, HTab *h_tab, size_t max_samples)
+{
+    HTabStats stats;
+    hm_tab_stats(h_tab, &stats, max_samples);
+
+    total.n_buckets += stats.n_buckets;
+    total.size += stats.size;
+    total.n_sampled += stats.n_sampled;
+    total.max_chain = std::max(total.max_chain, stats.max_chain);
+    for (size_t i = 0; i <= k_chain_hist; ++i)
+    {
+        total.chain_hist[i] += stats.chain_hist[i];
+    }
+}
+
+static void out_tab_stats(std::string &out, const char *name, HTabStats &stats)
+{
+    std::string prefix = name;
+    double load = stats.n_buckets ? (double)stats.size / stats.n_buckets : 0;
+
+    out_str(out, prefix + ".buckets");
+    out_int(out, (int64_t)stats.n_buckets);
+    out_str(out, prefix + ".size");
+    out_int(out, (int64_t)stats.size);
+    out_str(out, prefix + ".load_factor");
+    out_dbl(out, load);
+    out_str(out, prefix + ".sampled");
+    out_int(out, (int64_t)stats.n_sampled);
+    out_str(out, prefix + ".max_chain");
+    out_int(out, (int64_t)stats.max_chain);
+
+    // chain lengths 0, 1, ..., and the last one for longer chains
+    out_str(out, prefix + ".chain_hist");
+    out_arr(out, k_chain_hist + 1);
+    for (size_t i = 0; i <= k_chain_hist; ++i)
+    {
+        out_int(out, (int64_t)stats.chain_hist[i]);
+    }
+}
+
+// the slot number at `cmd[pos]`
+static bool parse_slot(std::vector<std::string> &cmd, size_t pos, size_t &slot)
+{
+    int64_t val = 0;
+    if (!str2int(cmd[pos], val) || val < 0 || (size_t)val >= ks_n_slots(g_data.ks))
+    {
+        return false;
+    }
+
+    slot = (size_t)val;
+    return true;
+}
+
+// debug htstats [slot]
+//
+// The health of the keyspace hashtables, summed over all slots or for one
+// slot: table sizes and load factors, chain length histograms, rehash
+// progress and the lookup probe counters. The counters of one slot are
+// those of its current table.
+static void do_htstats(std::vector<std::string> &cmd, std::string &out)
+{
+    size_t n_slots = ks_n_slots(g_data.ks);
+    if (!n_slots)
+    {
+        return out_err(out, ERR_ENGINE, "requires a hashtable engine");
+    }
+
+    size_t lo = 0, hi = n_slots;
+    if (cmd.size() == 3)
+    {
+        if (!parse_slot(cmd, 2, lo))
+        {
+            return out_err(out, ERR_ARG, "expect slot");
+        }
+        hi = lo + 1;
+    }
+
+    size_t n_used = 0;
+    for (size_t i = lo; i < hi; ++i)
+    {
+        n_used += ks_slot(g_data.ks, i) ? 1 : 0;
+    }
+
+    // spread the samples over the slots
+    size_t max_samples = std::max<size_t>(1, k_stats_samples / std::max<size_t>(1, n_used));
+
+    HTabStats h1, h2;
+    size_t size = 0, n_resizing = 0;
+    uint64_t n_lookups = 0, n_probes = 0, n_h2_hits = 0;
+    double progress = 0;
+
+    if (cmd.size() != 3)
+    {
+        KsLookupStats gone = ks_lookup_stats(g_data.ks);
+        n_lookups = gone.n_lookups;
+        n_probes = gone.n_probes;
+        n_h2_hits = gone.n_h2_hits;
+    }
+
+    for (size_t i = lo; i < hi; ++i)
+    {
+        EntryMap *hmap = ks_slot(g_data.ks, i);
+        if (!hmap)
+        {
+            continue;
+        }
+
+        HMap *db = &hmap->map;
+        size += hm_size(db);
+        n_lookups += db->n_lookups;
+        n_probes += db->n_probes;
+        n_h2_hits += db->n_h2_hits;
+
+        if (db->h2.tab)
+        {
+            n_resizing++;
+            progress += (double)db->resizing_pos / (db->h2.mask + 1);
+        }
+
+        add_tab_stats(h1, &db->h1, max_samples);
+        add_tab_stats(h2, &db->h2, max_samples);
+    }
+
+    out_arr(out, 2 * (8 + 6 * 2));
+    out_info(out, "size", (int64_t)size);
+    out_info(out, "slots_used", (int64_t)n_used);
+    out_info(out, "slots_resizing", (int64_t)n_resizing);
+    // the average over the resizing slots
+    out_str(out, "rehash_progress");
+    out_dbl(out, n_resizing ? progress / n_resizing : 1);
+    out_info(out, "lookups", (int64_t)n_lookups);
+    out_info(out, "probes", (int64_t)n_probes);
+    out_str(out, "avg_probes");
+    out_dbl(out, n_lookups ? (double)n_probes / n_lookups : 0);
+    out_info(out, "h2_hits", (int64_t)n_h2_hits);
+    out_tab_stats(out, "h1", h1);
+    out_tab_stats(out, "h2", h2);
+}
+
+// the optional `count N` at `cmd[pos]`
+static bool parse_count(std::vector<std::string> &cmd, size_t pos, int64_t &count)
+{
+    if (cmd.size() == pos)
+    {
+        return true;
+    }
+
+    return cmd.size() == pos + 2 && cmd_is(cmd[pos], "count") &&
+           str2int(cmd[pos + 1], count) && count > 0;
+}
+
+static void cb_scan_cursor(HNode *node, void *arg)
+{
+    ScanResult &res = *(ScanResult *)arg;
+    Entry *ent = EntryMap::owner(node);
+
+    if (!entry_expired(ent))
+    {
+        out_str(res.keys, ent->key);
+        res.n_keys++;
+    }
+}
+
+// scan cursor [count N]
+//
+// Returns the next cursor and a batch of keys, the iteration is done when
+// the cursor is back to 0. Each call visits a bounded number of buckets.
+static void do_scan(std::vector<std::string> &cmd, std::string &out)
+{
+    int64_t cursor = 0;
+    int64_t count = k_scan_count;
+
+    if (!str2int(cmd[1], cursor) || cursor < 0)
+    {
+        return out_err(out, ERR_ARG, "expect cursor");
+    }
+
+    if (!parse_count(cmd, 2, count))
+    {
+        return out_err(out, ERR_ARG, "expect count");
+    }
+
+    size_t n_slots = ks_n_slots(g_data.ks);
+    if (!n_slots)
+    {
+        return out_err(out, ERR_ENGINE, "requires a hashtable engine");
+    }
+
+    // the low bits of the cursor are the slot, the rest is the cursor
+    // within the slot, the slots are scanned one after another
+    ScanResult res;
+    int64_t max_steps = count * 10; // for sparse tables
+    size_t slot = (uint64_t)cursor % n_slots;
+    uint64_t next = (uint64_t)cursor / n_slots;
+
+    while (slot < n_slots && max_steps > 0 &&
+           res.n_keys < (uint64_t)count && res.keys.size() < k_max_msg / 2)
+    {
+        // empty slots cost a pointer check, not a step
+        EntryMap *hmap = ks_slot(g_data.ks, slot);
+        if (!hmap)
+        {
+            slot++;
+            next = 0;
+            continue;
+        }
+
+        next = hm_scan(&hmap->map, next, &cb_scan_cursor, &res);
+        max_steps--;
+
+        if (next == 0)
+        {
+            slot++;
+        }
+    }
+
+    next = slot == n_slots ? 0 : next * n_slots + slot;
+
+    out_arr(out, 2);
+    out_int(out, (int64_t)next);
+    out_scan_keys(out, res);
+}
+
+// keyslot key
+static void do_keyslot(std::vector<std::string> &cmd, std::string &out)
+{
+    if (!ks_n_slots(g_data.ks))
+    {
+        return out_err(out, ERR_ENGINE, "requires a hashtable engine");
+    }
+
+    out_int(out, (int64_t)ks_key_slot(g_data.ks, cmd[1]));
+}
+
+static void cb_slot_dump(HNode *node, void *arg)
+{
+    ScanResult &res = *(ScanResult *)arg;
+    Entry *ent = EntryMap::owner(node);
+
+    if (entry_expired(ent))
+    {
+        return;
+    }
+
+    out_str(res.keys, ent->key);
+    res.n_keys++;
+    if (res.limit == 0)
+    {
+        out_value(res.keys, ent);
+        res.n_keys++;
+    }
+}
+
+static void cb_slot_del(HNode *node, void *arg)
+{
+    (void)arg;
+    entry_retire(EntryMap::owner(node));
+}
+
+// slot count|keys|dump|del N [count C]
+//
+// `keys` returns a batch of about C keys of the slot, `dump` the key value pairs of
+// the whole slot, `del` deletes the slot and returns the number of keys.
+static void do_slot(std::vector<std::string> &cmd, std::string &out)
+{
+    size_t slot = 0;
+
+    if (!ks_n_slots(g_data.ks))
+    {
+        return out_err(out, ERR_ENGINE, "requires a hashtable engine");
+    }
+
+    if (!parse_slot(cmd, 2, slot))
+    {
+        return out_err(out, ERR_ARG, "expect slot");
+    }
+
+    EntryMap *hmap = ks_slot(g_data.ks, slot);
+
+    if (cmd_is(cmd[1], "count") && cmd.size() == 3)
+    {
+        return out_int(out, hmap ? (int64_t)hmap->size() : 0);
+    }
+
+    if (cmd_is(cmd[1], "del") && cmd.size() == 3)
+    {
+        hmap = ks_slot_detach(g_data.ks, slot);
+        if (!hmap)
+        {
+            return out_int(out, 0);
+        }
+
+        size_t n_keys = hmap->size();
+        for (uint64_t cursor = hm_scan(&hmap->map, 0, &cb_slot_del, NULL); cursor;)
+        {
+            cursor = hm_scan(&hmap->map, cursor, &cb_slot_del, NULL);
+        }
+
+        hmap->destroy();
+        delete hmap;
+
+        return out_int(out, (int64_t)n_keys);
+    }
+
+    ScanResult res;
+    if (cmd_is(cmd[1], "keys"))
+    {
+        res.limit = k_scan_count;
+        if (!parse_count(cmd, 3, res.limit))
+        {
+            return out_err(out, ERR_ARG, "expect count");
+        }
+    }
+    else if (!(cmd_is(cmd[1], "dump") && cmd.size() == 3))
+    {
+        return out_err(out, ERR_UNKNOWN, "Unknown cmd");
+    }
+
+    // a dump that doesn't fit is reported as too big
+    uint64_t cursor = 0;
+    do
+    {
+        cursor = hmap ? hm_scan(&hmap->map, cursor, &cb_slot_dump, &res) : 0;
+    } while (cursor && (res.limit == 0 || res.n_keys < (uint64_t)res.limit));
+
+    out_scan_keys(out, res);
+}
+
+static bool cb_prefix_scan(Entry *ent, void *arg)
+{
+    ScanResult &res = *(ScanResult *)arg;
+    const std::string &key = ent->key;
+
+    if (key.compare(0, res.prefix.size(), res.prefix) != 0)
+    {
+        return false; // past the prefix
+    }
+
+    if (entry_expired(ent))
+    {
+        return true;
+    }
+
+    out_str(res.keys, key);
+    res.n_keys++;
+
+    return res.n_keys < (uint64_t)res.limit && res.keys.size() < k_max_msg / 2;
+}
+
+// prefixscan prefix [count N]
+//
+// Keys with the prefix in order. Continue with `range` from the last key.
+static void do_prefixscan(std::vector<std::string> &cmd, std::string &out)
+{
+    ScanResult res;
+    res.limit = k_scan_count;
+
+    if (!parse_count(cmd, 2, res.limit))
+    {
+        return out_err(out, ERR_ARG, "expect count");
+    }
+
+    if (!g_data.ks->ops->iter_from)
+    {
+        return out_err(out, ERR_ENGINE, "requires an ordered engine");
+    }
+
+    res.prefix.swap(cmd[1]);
+    g_data.ks->ops->iter_from(g_data.ks, res.prefix, &cb_prefix_scan, &res);
+
+    out_scan_keys(out, res);
+}
+
+static bool cb_range(Entry *ent, void *arg)
+{
+    ScanResult &res = *(ScanResult *)arg;
+    const std::string &key = ent->key;
+
+    if (!res.end.empty() && key >= res.end)
+    {
+        return false;
+    }
+
+    if (entry_expired(ent))
+    {
+        return true;
+    }
+
+    out_str(res.keys, key);
+    res.n_keys++;
+
+    return res.n_keys < (uint64_t)res.limit && res.keys.size() < k_max_msg / 2;
+}
+
+// range start end [count N]
+//
+// Keys in [start, end) in order, an empty end means no upper bound.
+static void do_range(std::vector<std::string> &cmd, std::string &out)
+{
+    ScanResult res;
+    res.limit = k_scan_count;
+
+    if (!parse_count(cmd, 3, res.limit))
+    {
+        return out_err(out, ERR_ARG, "expect count");
+    }
+
+    if (!g_data.ks->ops->iter_from)
+    {
+        return out_err(out, ERR_ENGINE, "requires an ordered engine");
+    }
+
+    res.end.swap(cmd[2]);
+    g_data.ks->ops->iter_from(g_data.ks, cmd[1], &cb_range, &res);
+
+    out_scan_keys(out, res);
+}
+
+// the commands refused while shedding load
+static bool cmd_is_write(std::vector<std::string> &cmd)
+{
+    const char *writes[] = {"set", "del", "expire", "pexpire", "persist"};
+
+    for (const char *name : writes)
+    {
+        if (cmd_is(cmd[0], name))
+        {
+            return true;
+        }
+    }
+
+    return cmd.size() >= 2 && cmd_is(cmd[0], "slot") && cmd_is(cmd[1], "del");
+}
+
+static void do_request(std::vector<std::string> &cmd, std::string &out)
+{
+    if (cmd.size() == 1 && cmd_is(cmd[0], "keys"))
+    {
+        do_keys(cmd, out);
+    }
+    else if ((cmd.size() == 2 || cmd.size() == 4) && cmd_is(cmd[0], "scan"))
+    {
+        do_scan(cmd, out);
+    }
+    else if ((cmd.size() == 2 || cmd.size() == 4) && cmd_is(cmd[0], "prefixscan"))
+    {
+        do_prefixscan(cmd, out);
+    }
+    else if ((cmd.size() == 3 || cmd.size() == 5) && cmd_is(cmd[0], "range"))
+    {
+        do_range(cmd, out);
+    }
+    else if (cmd.size() == 2 && cmd_is(cmd[0], "keyslot"))
+    {
+        do_keyslot(cmd, out);
+    }
+    else if ((cmd.size() == 3 || cmd.size() == 5) && cmd_is(cmd[0], "slot"))
+    {
+        do_slot(cmd, out);
+    }
+    else if ((cmd.size() == 2 || cmd.size() == 3) && cmd_is(cmd[0], "debug") && cmd_is(cmd[1], "htstats"))
+    {
+        do_htstats(cmd, out);
+    }
+    else if (cmd.size() == 2 && cmd_is(cmd[0], "debug") && cmd_is(cmd[1], "slabstats"))
+    {
+        do_slabstats(cmd, out);
+    }
+    else if (cmd.size() == 1 && cmd_is(cmd[0], "ping"))
+    {
+        out_str(out, "PONG");
+    }
+    else if (cmd.size() == 1 && cmd_is(cmd[0], "info"))
+    {
+        do_info(cmd, out);
+    }
+    else if (cmd.size() == 2 && cmd_is(cmd[0], "get"))
+    {
+        do_get(cmd, out);
+    }
+    else if ((cmd.size() == 3 || cmd.size() == 5) && cmd_is(cmd[0], "set"))
+    {
+        do_set(cmd, out);
+    }
+    else if (cmd.size() == 2 && cmd_is(cmd[0], "del"))
+    {
+        do_del(cmd, out);
+    }
+    else if (cmd.size() == 3 && (cmd_is(cmd[0], "expire") || cmd_is(cmd[0], "pexpire")))
+    {
+        do_expire(cmd, out);
+    }
+    else if (cmd.size() == 2 && (cmd_is(cmd[0], "ttl") || cmd_is(cmd[0], "pttl")))
+    {
+        do_ttl(cmd, out);
+    }
+    else if (cmd.size() == 2 && cmd_is(cmd[0], "persist"))
+    {
+        do_persist(cmd, out);
+    }
+    else
+    {
+        // cmd is not recognized
+        out_err(out, ERR_UNKNOWN, "Unknown cmd");
+    }
+}
+
+// move the value buffer and the Entry out of sparse slabs,
+// returns the new location of the Entry
+static Entry *defrag_entry(Entry *ent)
+{
+    SlabString &val = ent->value;
+
+    if (val.capacity() > SlabString().capacity() &&
+        slab_is_sparse(&val[0], val.capacity() + 1))
+    {
+        SlabString copy(val);
+        val.swap(copy);
+        g_defrag.n_moved++;
+    }
+
+    // entries with `--hugepages` are not in the slabs
+    if (hp_enabled() || !slab_is_sparse(ent, sizeof(Entry)))
+    {
+        return ent;
+    }
+
+    Entry *moved = entry_new();
+    moved->node = ent->node;
+    moved->key.swap(ent->key);
+    moved->value.swap(ent->value);
+    std::swap(moved->log, ent->log);
+    if (moved->log)
+    {
+        log_set_ref(moved->log, &moved->log);
+    }
+    moved->access = ent->access;
+    std::swap(moved->heap_idx, ent->heap_idx);
+    if (moved->heap_idx != k_no_ttl)
+    {
+        g_data.heap[moved->heap_idx].ref = &moved->heap_idx;
+    }
+    entry_del(ent);
+    g_defrag.n_moved++;
+
+    return moved;
+}
+
+// false if `pos` is past both tables
+static bool defrag_bucket(HMap *db, size_t pos)
+{
+    HTab *h_tab = &db->h1;
+    size_t n_h1 = h_tab->tab ? h_tab->mask + 1 : 0;
+
+    if (pos >= n_h1)
+    {
+        pos -= n_h1;
+        h_tab = &db->h2;
+    }
+
+    if (!h_tab->tab || pos > h_tab->mask)
+    {
+        return false;
+    }
+
+    // relink each moved node through the pointer that points to it
+    for (HNode **from = &h_tab->tab[pos]; *from; from = &(*from)->next)
+    {
+        *from = &defrag_entry(EntryMap::owner(*from))->node;
+    }
+
+    return true;
+}
+
+// Relocate entries from sparse slabs to dense ones within the time
+// budget, the emptied slabs are released. Called outside of the epoch
+// critical section, so nothing can still point to the old copies.
+static void defrag_step()
+{
+    size_t n_slots = ks_n_slots(g_data.ks);
+    if (!g_defrag.enabled || !n_slots)
+    {
+        return;
+    }
+
+    uint64_t now = get_monotonic_usec();
+
+    if (!g_defrag.active)
+    {
+        if (now < g_defrag.last_pass_usec + k_defrag_interval_usec)
+        {
+            return;
+        }
+
+        size_t mapped = slab_mapped_bytes();
+        size_t used = 0;
+
+        SlabStats slabs[k_slab_classes];
+        slab_stats(slabs);
+        for (SlabStats &st : slabs)
+        {
+            used += st.n_used * st.obj_size;
+        }
+
+        // checked once per interval, so that poll() sleeps in between
+        if (mapped < k_defrag_min_bytes || mapped * 100 < used * k_defrag_min_frag)
+        {
+            g_defrag.last_pass_usec = now;
+            return;
+        }
+
+        g_defrag.active = true;
+        g_defrag.slot = 0;
+        g_defrag.pos = 0;
+    }
+
+    uint64_t deadline = now + k_defrag_budget_usec;
+    slab_defrag_mode(true);
+
+    for (size_t n = 1; g_defrag.slot < n_slots; ++n)
+    {
+        EntryMap *hmap = ks_slot(g_data.ks, g_defrag.slot);
+
+        if (hmap && defrag_bucket(&hmap->map, g_defrag.pos))
+        {
+            g_defrag.pos++;
+        }
+        else
+        {
+            g_defrag.slot++;
+            g_defrag.pos = 0;
+        }
+
+        if (n % 64 == 0 && get_monotonic_usec() >= deadline)
+        {
+            break;
+        }
+    }
+
+    slab_defrag_mode(false);
+
+    if (g_defrag.slot == n_slots)
+    {
+        g_defrag.active = false;
+        g_defrag.last_pass_usec = get_monotonic_usec();
+        g_defrag.n_passes++;
+    }
+}
+
+// remove the expired keys from the top of the heap within the time budget
+static void expire_step()
+{
+    uint64_t now_ms = get_monotonic_msec();
+    uint64_t deadline = get_monotonic_usec() + k_expire_budget_usec;
+    std::vector<HeapItem> &heap = g_data.heap;
+
+    for (size_t n = 1; !heap.empty() && heap[0].val <= now_ms; ++n)
+    {
+        Entry *ent = container_of(heap[0].ref, Entry, heap_idx);
+        Entry *popped = ks_pop(g_data.ks, ent->key);
+        assert(popped == ent);
+
+        entry_retire(popped);
+        g_data.n_expired++;
+
+        if (n % 64 == 0 && get_monotonic_usec() >= deadline)
+        {
+            break;
+        }
+    }
+}
+
+// the poll() timeout, until the next timer, or -1 to wait for IO only
+static int next_timeout_ms()
+{
+    if (g_defrag.active || g_data.log_cleaning || g_conns.n_ready)
+    {
+        return 0; // busy
+    }
+
+    uint64_t next_us = UINT64_MAX;
+    if (!g_data.heap.empty())
+    {
+        next_us = g_data.heap[0].val * 1000;
+    }
+
+    // an idle server sleeps here, every deadline must move forward once
+    // it is handled, or poll() spins with a timeout of 0
+    if (g_defrag.enabled)
+    {
+        next_us = std::min(next_us, g_defrag.last_pass_usec + k_defrag_interval_usec);
+    }
+
+    uint64_t next_tick = tw_next(&g_conns.timers);
+    if (next_tick != UINT64_MAX)
+    {
+        next_us = std::min(next_us, next_tick * 1000);
+    }
+
+    if (next_us == UINT64_MAX)
+    {
+        return -1;
+    }
+
+    uint64_t now_us = get_monotonic_usec();
+    if (next_us <= now_us)
+    {
+        return 0;
+    }
+
+    return (int)std::min<uint64_t>((next_us - now_us + 999) / 1000, INT32_MAX);
+}
+
+static void fd_set_nb(int fd)
+{
+    errno = 0;
+    int flags = fcntl(fd, F_GETFL, 0);
+
+    if (errno)
+    {
+        die("fcntl() error");
+        return;
+    }
+
+    flags |= O_NONBLOCK;
+
+    errno = 0;
+
+    (void)fcntl(fd, F_SETFL, flags);
+
+    if (errno)
+    {
+        die("fcntl() error");
+    }
+}
+
+static uint8_t *buf_get()
+{
+    uint8_t *buf = NULL;
+
+    if (!g_conns.free_bufs.empty())
+    {
+        buf = g_conns.free_bufs.back();
+        g_conns.free_bufs.pop_back();
+    }
+    else if (!(buf = (uint8_t *)malloc(k_conn_buf_size)))
+    {
+        die("out of memory");
+    }
+
+    g_conns.n_bufs_used++;
+    return buf;
+}
+
+// return a buffer to the pool and clear the pointer
+static void buf_put(uint8_t *&buf)
+{
+    if (!buf)
+    {
+        return;
+    }
+
+    if (g_conns.free_bufs.size() < k_buf_pool_max)
+    {
+        g_conns.free_bufs.push_back(buf);
+    }
+    else
+    {
+        free(buf);
+    }
+
+    g_conns.n_bufs_used--;
+    buf = NULL;
+}
+
+static void conn_put(std::vector<Conn *> &fd2conn, struct Conn *conn)
+{
+    if (fd2conn.size() <= (size_t)conn->fd)
+    {
+        fd2conn.resize(conn->fd + 1);
+    }
+
+    fd2conn[conn->fd] = conn;
+}
+
+// the connection was active, push back its idle timeout
+static void conn_touch(Conn *conn)
+{
+    if (g_conns.idle_timeout_ms)
+    {
+        tw_add(&g_conns.timers, &conn->idle_timer, get_monotonic_msec() + g_conns.idle_timeout_ms);
+    }
+}
+
+static void conn_set_ready(Conn *conn, bool ready)
+{
+    if (conn->ready != ready)
+    {
+        conn->ready = ready;
+        g_conns.n_ready += ready ? 1 : -1;
+    }
+}
+
+static void conn_destroy(std::vector<Conn *> &fd2conn, Conn *conn)
+{
+    tw_del(&g_conns.timers, &conn->idle_timer);
+    tw_del(&g_conns.timers, &conn->output_timer);
+    conn_set_ready(conn, false);
+    fd2conn[conn->fd] = NULL;
+    (void)close(conn->fd);
+
+    buf_put(conn->r_buf);
+    buf_put(conn->w_buf);
+    conn->~Conn();
+    slab_free(conn, sizeof(Conn));
+    g_conns.n_conns--;
+}
+
+static void cb_idle_timeout(TimerNode *node, void *arg)
+{
+    Conn *conn = container_of(node, Conn, idle_timer);
 
-    if (errno)
-    {
-        die("fcntl() error");
-    }
+    conn_destroy(*(std::vector<Conn *> *)arg, conn);
+    g_conns.n_idle_closed++;
 }
 
-static void conn_put(std::vector<Conn *> &fd2conn, struct Conn *conn)
+static void cb_output_timeout(TimerNode *node, void *arg)
 {
-    if (fd2conn.size() <= (size_t)conn->fd)
-    {
-        fd2conn.resize(conn->fd + 1);
-    }
+    Conn *conn = container_of(node, Conn, output_timer);
 
-    fd2conn[conn->fd] = conn;
+    msg("output over the soft limit for too long");
+    conn_destroy(*(std::vector<Conn *> *)arg, conn);
+    g_conns.n_output_closed++;
 }
 
-static int32_t accept_new_conn(std::vector<Conn *> &fd2conn, int fd)
+static int32_t accept_new_conn(std::vector<Conn *> &fd2conn, int fd, bool admin)
 {
     // accept
     struct sockaddr_in client_addr = {};
@@ -366,22 +1811,40 @@ static int32_t accept_new_conn(std::vector<Conn *> &fd2conn, int fd)
     // set the new connection fd to non-blocking mode
     fd_set_nb(conn_fd);
 
-    // creating the struct conn
-    struct Conn *conn = (struct Conn *)malloc(sizeof(struct Conn));
+    // responses are already batched, a budget-limited batch must not
+    // wait for the ACK of the previous one
+    int val = 1;
+    setsockopt(conn_fd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val));
+
+#ifdef SO_BUSY_POLL
+    // let the kernel poll the device queue on reads, may need CAP_NET_ADMIN
+    if (g_busy.spin_usec)
+    {
+        int usec = (int)std::min<uint64_t>(g_busy.spin_usec, INT32_MAX);
+        (void)setsockopt(conn_fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec));
+    }
+#endif
+
+    // creating the struct conn, without buffers until there is IO
+    void *mem = slab_alloc(sizeof(Conn));
 
-    if (!conn)
+    if (!mem)
     {
         close(conn_fd);
         return -1;
     }
 
+    struct Conn *conn = new (mem) Conn();
+
     conn->fd = conn_fd;
     conn->state = STATE_REQ;
-    conn->r_buf_size = 0;
-    conn->w_buf_size = 0;
-    conn->w_buf_sent = 0;
+    conn->admin = admin;
+    conn->idle_timer.cb = &cb_idle_timeout;
+    conn->output_timer.cb = &cb_output_timeout;
 
     conn_put(fd2conn, conn);
+    conn_touch(conn);
+    g_conns.n_conns++;
 
     return 0;
 }
@@ -392,7 +1855,10 @@ static void state_res(Conn *conn);
 static bool try_one_request(Conn *conn)
 {
     // try to parse the request from the buffer
-    if (conn->r_buf_size < 4)
+    uint8_t *req = &conn->r_buf[conn->r_buf_pos];
+    size_t avail = conn->r_buf_size - conn->r_buf_pos;
+
+    if (avail < 4)
     {
         // not enough data in the buffer
         // will have to retry in the next iteration
@@ -400,7 +1866,7 @@ static bool try_one_request(Conn *conn)
     }
 
     uint32_t len = 0;
-    memcpy(&len, &conn->r_buf[0], 4);
+    memcpy(&len, req, 4);
 
     if (len > k_max_msg)
     {
@@ -409,7 +1875,7 @@ static bool try_one_request(Conn *conn)
         return false;
     }
 
-    if (4 + len > conn->r_buf_size)
+    if (4 + len > avail)
     {
         // not enough data in the buffer
         // will have to retry in the next iteration
@@ -418,8 +1884,9 @@ static bool try_one_request(Conn *conn)
 
     // parse the request
     std::vector<std::string> cmd;
+    uint64_t deadline = 0;
 
-    if (0 != parse_req(&conn->r_buf[4], len, cmd))
+    if (0 != parse_req(&req[4], len, cmd, deadline))
     {
         msg("bad req");
         conn->state = STATE_END;
@@ -429,7 +1896,22 @@ static bool try_one_request(Conn *conn)
 
     // got one request, generate the response
     std::string out;
-    do_request(cmd, out);
+
+    if (deadline && deadline < get_realtime_usec())
+    {
+        // nobody waits for the response anymore
+        out_err(out, ERR_DEADLINE, "deadline exceeded");
+        g_conns.n_deadline_exceeded++;
+    }
+    else if (g_conns.shedding && !conn->admin && !cmd.empty() && cmd_is_write(cmd))
+    {
+        out_err(out, ERR_BUSY, "server is overloaded");
+        g_conns.n_shed_writes++;
+    }
+    else
+    {
+        do_request(cmd, out);
+    }
 
     // pack the response into the buffer
     if (4 + out.size() > k_max_msg)
@@ -438,40 +1920,80 @@ static bool try_one_request(Conn *conn)
         out_err(out, ERR_2BIG, "response is too big");
     }
 
+    if (!conn->w_buf)
+    {
+        conn->w_buf = buf_get();
+    }
+
+    // after the responses of the previous pipelined requests
+    uint8_t *w_ptr = &conn->w_buf[conn->w_buf_size];
     uint32_t w_len = (uint32_t)out.size();
-    memcpy(&conn->w_buf[0], &w_len, 4);
-    memcpy(&conn->w_buf[4], out.data(), out.size());
+    memcpy(&w_ptr[0], &w_len, 4);
+    memcpy(&w_ptr[4], out.data(), out.size());
 
-    conn->w_buf_size = 4 + w_len;
+    conn->w_buf_size += 4 + w_len;
 
-    // removing the request from the buffer
-    size_t remain = conn->r_buf_size - 4 - len;
+    // consume the request, the rest is moved only when a read needs the space
+    conn->r_buf_pos += 4 + len;
 
-    if (remain)
+    if (conn->r_buf_pos == conn->r_buf_size)
     {
-        memmove(conn->r_buf, &conn->r_buf[4 + len], remain);
+        conn->r_buf_pos = 0;
+        conn->r_buf_size = 0;
     }
 
-    conn->r_buf_size = remain;
+    return true;
+}
 
-    // change state
+static void flush_responses(Conn *conn)
+{
     conn->state = STATE_RES;
     state_res(conn);
+}
 
-    // continue the outer loop if the request was successfully processed
-    return (conn->state == STATE_REQ);
+// Handle the complete requests in the buffer. Their responses are sent
+// together, or earlier when the next one might not fit.
+static void process_requests(Conn *conn)
+{
+    while (conn->state == STATE_REQ && conn->budget > 0 && try_one_request(conn))
+    {
+        conn->budget--;
+
+        if (k_conn_buf_size - conn->w_buf_size < 4 + k_max_msg)
+        {
+            flush_responses(conn);
+        }
+    }
+
+    if (conn->state == STATE_REQ && conn->w_buf_size > 0)
+    {
+        flush_responses(conn);
+    }
 }
 
 static bool try_fill_buffer(Conn *conn)
 {
     // try to fill the buffer
-    assert(conn->r_buf_size < sizeof(conn->r_buf));
+    if (!conn->r_buf)
+    {
+        conn->r_buf = buf_get();
+    }
+
+    // out of space, move the unconsumed bytes to the front
+    if (conn->r_buf_size == k_conn_buf_size && conn->r_buf_pos > 0)
+    {
+        conn->r_buf_size -= conn->r_buf_pos;
+        memmove(conn->r_buf, &conn->r_buf[conn->r_buf_pos], conn->r_buf_size);
+        conn->r_buf_pos = 0;
+    }
+
+    assert(conn->r_buf_size < k_conn_buf_size);
 
     ssize_t rv = 0;
 
     do
     {
-        size_t cap = sizeof(conn->r_buf) - conn->r_buf_size;
+        size_t cap = k_conn_buf_size - conn->r_buf_size;
         rv = read(conn->fd, &conn->r_buf[conn->r_buf_size], cap);
     } while (rv < 0 && errno == EINTR);
 
@@ -505,20 +2027,29 @@ static bool try_fill_buffer(Conn *conn)
     }
 
     conn->r_buf_size += (size_t)rv;
-    assert(conn->r_buf_size <= sizeof(conn->r_buf));
+    assert(conn->r_buf_size <= k_conn_buf_size);
 
-    // try to process requests one by one
-    while (try_one_request(conn))
-    {
-    }
+    process_requests(conn);
 
     return (conn->state == STATE_REQ);
 }
 
 static void state_req(Conn *conn)
 {
-    while (try_fill_buffer(conn))
+    // the requests still buffered while the last responses were in flight
+    if (conn->r_buf)
+    {
+        process_requests(conn);
+    }
+
+    while (conn->state == STATE_REQ && conn->budget > 0 && try_fill_buffer(conn))
+    {
+    }
+
+    // an idle connection holds no buffer
+    if (conn->r_buf_size == 0)
     {
+        buf_put(conn->r_buf);
     }
 }
 
@@ -530,7 +2061,7 @@ static bool try_flush_buffer(Conn *conn)
     {
         size_t remain = conn->w_buf_size - conn->w_buf_sent;
         rv = write(conn->fd, &conn->w_buf[conn->w_buf_sent], remain);
-    } while (rv < 0 && errno == EAGAIN);
+    } while (rv < 0 && errno == EINTR);
 
     if (rv < 0 && errno == EAGAIN)
     {
@@ -552,11 +2083,12 @@ static bool try_flush_buffer(Conn *conn)
 
     if (conn->w_buf_sent == conn->w_buf_size)
     {
-        // response was fully sent,
+        // responses were fully sent,
         // change the state back
         conn->state = STATE_REQ;
         conn->w_buf_sent = 0;
         conn->w_buf_size = 0;
+        buf_put(conn->w_buf);
 
         return false;
     }
@@ -565,15 +2097,61 @@ static bool try_flush_buffer(Conn *conn)
     return true;
 }
 
+// the client doesn't read its responses fast enough
+static void check_output_limit(Conn *conn)
+{
+    OutputLimit &limit = g_conns.output_limit;
+    size_t pending = conn->w_buf_size - conn->w_buf_sent;
+
+    // the socket is full, count what is queued in the kernel too
+    int queued = 0;
+    if (pending && (limit.hard_bytes || limit.soft_bytes)
+        && 0 == ioctl(conn->fd, SIOCOUTQ, &queued))
+    {
+        pending += (size_t)queued;
+    }
+
+    if (limit.hard_bytes && pending > limit.hard_bytes)
+    {
+        msg("output over the hard limit");
+        conn->state = STATE_END;
+        g_conns.n_output_closed++;
+    }
+    else if (limit.soft_bytes && pending > limit.soft_bytes)
+    {
+        if (!tw_armed(&conn->output_timer))
+        {
+            tw_add(&g_conns.timers, &conn->output_timer,
+                   get_monotonic_msec() + limit.soft_secs * 1000);
+        }
+    }
+    else
+    {
+        tw_del(&g_conns.timers, &conn->output_timer);
+    }
+}
+
+// Send the responses until the socket is full. No more requests are read
+// until they are all sent, so the pending output of a connection is
+// bounded by its buffer and the socket's.
 static void state_res(Conn *conn)
 {
     while (try_flush_buffer(conn))
     {
     }
+
+    if (conn->state != STATE_END)
+    {
+        check_output_limit(conn);
+    }
 }
 
 static void connection_io(Conn *conn)
 {
+    conn_touch(conn);
+    conn->budget = k_conn_budget;
+    conn_set_ready(conn, false);
+
     if (conn->state == STATE_REQ)
     {
         state_req(conn);
@@ -581,14 +2159,135 @@ static void connection_io(Conn *conn)
     else if (conn->state == STATE_RES)
     {
         state_res(conn);
+
+        if (conn->state == STATE_REQ)
+        {
+            state_req(conn);
+        }
     }
     else
     {
         assert(0); // not expected
     }
+
+    // out of budget, the rest waits for the other connections
+    if (conn->state == STATE_REQ && conn->budget == 0)
+    {
+        conn_set_ready(conn, true);
+        conn->ready_usec = get_monotonic_usec();
+        g_conns.n_deferred++;
+    }
+}
+
+// poll(), after spinning on non-blocking checks for up to `g_busy.spin_usec`
+static int poll_wait(std::vector<struct pollfd> &args, int timeout_ms)
+{
+    if (!g_busy.spin_usec || timeout_ms == 0)
+    {
+        return poll(args.data(), (nfds_t)args.size(), timeout_ms);
+    }
+
+    uint64_t start = get_monotonic_usec();
+    uint64_t spin = g_busy.spin_usec;
+    if (timeout_ms > 0)
+    {
+        spin = std::min(spin, (uint64_t)timeout_ms * 1000);
+    }
+
+    uint64_t now = start;
+    do
+    {
+        int rv = poll(args.data(), (nfds_t)args.size(), 0);
+        if (rv != 0)
+        {
+            g_busy.n_spin_hits += rv > 0;
+            g_busy.idle_spin_usec += get_monotonic_usec() - start;
+            return rv;
+        }
+        now = get_monotonic_usec();
+    } while (now - start < spin);
+
+    g_busy.idle_spin_usec += now - start;
+
+    // nothing came, block for the rest
+    if (timeout_ms > 0)
+    {
+        timeout_ms = (int)std::max<int64_t>(0, timeout_ms - (int64_t)((now - start) / 1000));
+    }
+    return poll(args.data(), (nfds_t)args.size(), timeout_ms);
+}
+
+// refuse a connection while shedding load, with an error as the reply
+static void reject_conn(int fd)
+{
+    int conn_fd = accept(fd, NULL, NULL);
+    if (conn_fd < 0)
+    {
+        return;
+    }
+
+    std::string out;
+    out_err(out, ERR_BUSY, "server is overloaded");
+
+    uint32_t len = (uint32_t)out.size();
+    out.insert(0, (char *)&len, 4);
+
+    // best effort, the socket buffer of a new connection is empty
+    fd_set_nb(conn_fd);
+    ssize_t rv = write(conn_fd, out.data(), out.size());
+    (void)rv;
+    (void)close(conn_fd);
+
+    g_conns.n_shed_conns++;
+}
+
+static void serve_conn(std::vector<Conn *> &fd2conn, struct pollfd &pfd)
+{
+    Conn *conn = fd2conn[pfd.fd];
+
+    if (conn && (pfd.revents || conn->ready))
+    {
+        // ready since the poll(), or since it was deferred
+        uint64_t since = conn->ready ? conn->ready_usec : g_conns.poll_usec;
+        uint64_t lag = get_monotonic_usec() - std::min(since, g_conns.poll_usec);
+        g_conns.max_lag_usec = std::max(g_conns.max_lag_usec, lag);
+
+        if (g_conns.shed_lag_usec && lag > g_conns.shed_lag_usec)
+        {
+            g_conns.shedding = true;
+        }
+
+        connection_io(conn);
+
+        if (conn->state == STATE_END)
+        {
+            // client closed normally, or something bad happened.
+            // destroy this connection
+            conn_destroy(fd2conn, conn);
+        }
+    }
 }
 
-int main()
+// the admin listening fd and connections, `n` poll arguments
+static void serve_admin(std::vector<Conn *> &fd2conn, struct pollfd *args, size_t n, int admin_fd)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (args[i].fd == admin_fd)
+        {
+            if (args[i].revents)
+            {
+                (void)accept_new_conn(fd2conn, admin_fd, true);
+            }
+        }
+        else
+        {
+            serve_conn(fd2conn, args[i]);
+        }
+    }
+}
+
+static int listen_on(uint16_t port)
 {
     int fd = socket(AF_INET, SOCK_STREAM, 0);
     if (fd < 0)
@@ -603,7 +2302,7 @@ int main()
     struct sockaddr_in addr = {};
 
     addr.sin_family = AF_INET;
-    addr.sin_port = ntohs(1234);
+    addr.sin_port = ntohs(port);
     addr.sin_addr.s_addr = ntohl(0); // wildcard address 0.0.0.0
 
     int rv = bind(fd, (const sockaddr *)&addr, sizeof(addr));
@@ -621,12 +2320,220 @@ int main()
         die("listen()");
     }
 
-    // a map of all client connections, keyed by fd
-    std::vector<Conn *> fd2conn;
-
     // set the listen fd to nonblocking mode
     fd_set_nb(fd);
 
+    return fd;
+}
+
+static bool parse_bytes(const char *str, size_t &bytes)
+{
+    char *endp = NULL;
+    unsigned long long val = strtoull(str, &endp, 10);
+
+    int unit = tolower(*endp);
+    int shift = unit == 'k' ? 10 : unit == 'm' ? 20 : unit == 'g' ? 30 : 0;
+    if (shift)
+    {
+        endp++;
+    }
+
+    if (tolower(*endp) == 'b')
+    {
+        endp++;
+    }
+
+    bytes = (size_t)(val << shift);
+    return endp != str && *endp == 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *engine = "slots";
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (0 == strcmp(argv[i], "--engine") && i + 1 < argc)
+        {
+            // slots, hmap, art or map
+            engine = argv[++i];
+        }
+        else if (0 == strcmp(argv[i], "--hugepages"))
+        {
+            // entries, the slot array and bucket arrays of 1 MiB or more
+            // on 2 MiB pages; the small per-slot tables of the slots engine
+            // stay on normal pages, only `--engine hmap` grows one that big
+            hp_enable(true);
+            hm_use_hugepages(true);
+        }
+        else if (0 == strcmp(argv[i], "--slab-release"))
+        {
+            // unmap the slabs that become empty
+            slab_set_release(true);
+        }
+        else if (0 == strcmp(argv[i], "--defrag"))
+        {
+            // relocate entries out of sparse slabs and release them
+            g_defrag.enabled = true;
+            slab_set_release(true);
+        }
+        else if (0 == strcmp(argv[i], "--log-values"))
+        {
+            // values in log segments, compacted by a cleaner
+            g_data.log_values = true;
+        }
+        else if (0 == strcmp(argv[i], "--maxmemory") && i + 1 < argc)
+        {
+            // bytes, with an optional k, m or g suffix
+            if (!parse_bytes(argv[++i], g_data.maxmemory))
+            {
+                fprintf(stderr, "bad maxmemory: %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (0 == strcmp(argv[i], "--maxmemory-policy") && i + 1 < argc)
+        {
+            // noeviction, allkeys-lru, allkeys-lfu, volatile-lru or volatile-lfu
+            g_data.evict_policy = evict_policy(argv[++i]);
+            if (g_data.evict_policy < 0)
+            {
+                fprintf(stderr, "unknown maxmemory policy: %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (0 == strcmp(argv[i], "--idle-timeout") && i + 1 < argc)
+        {
+            // seconds, 0 keeps idle connections forever
+            int64_t secs = 0;
+            if (!str2int(argv[++i], secs) || secs < 0)
+            {
+                fprintf(stderr, "bad idle timeout: %s\n", argv[i]);
+                return 1;
+            }
+            g_conns.idle_timeout_ms = (uint64_t)secs * 1000;
+        }
+        else if (0 == strcmp(argv[i], "--output-limit") && i + 3 < argc)
+        {
+            // <hard bytes> <soft bytes> <soft seconds>, 0 for no limit
+            OutputLimit &limit = g_conns.output_limit;
+            int64_t secs = 0;
+            if (!parse_bytes(argv[i + 1], limit.hard_bytes)
+                || !parse_bytes(argv[i + 2], limit.soft_bytes)
+                || !str2int(argv[i + 3], secs) || secs < 0)
+            {
+                fprintf(stderr, "bad output limit: %s %s %s\n", argv[i + 1], argv[i + 2], argv[i + 3]);
+                return 1;
+            }
+            limit.soft_secs = (uint64_t)secs;
+            i += 3;
+        }
+        else if (0 == strcmp(argv[i], "--admin-port") && i + 1 < argc)
+        {
+            // a second port whose connections are served first
+            int64_t port = 0;
+            if (!str2int(argv[++i], port) || port <= 0 || port > 65535 || port == 1234)
+            {
+                fprintf(stderr, "bad admin port: %s\n", argv[i]);
+                return 1;
+            }
+            g_conns.admin_port = (uint16_t)port;
+        }
+        else if (0 == strcmp(argv[i], "--shed-lag") && i + 1 < argc)
+        {
+            // milliseconds of event loop lag, 0 never sheds
+            int64_t ms = 0;
+            if (!str2int(argv[++i], ms) || ms < 0)
+            {
+                fprintf(stderr, "bad shed lag: %s\n", argv[i]);
+                return 1;
+            }
+            g_conns.shed_lag_usec = (uint64_t)ms * 1000;
+        }
+        else if (0 == strcmp(argv[i], "--busy-poll") && i + 1 < argc)
+        {
+            // microseconds to spin before blocking, for low latency
+            int64_t usec = 0;
+            if (!str2int(argv[++i], usec) || usec < 0)
+            {
+                fprintf(stderr, "bad busy poll: %s\n", argv[i]);
+                return 1;
+            }
+            g_busy.spin_usec = (uint64_t)usec;
+        }
+        else if (0 == strcmp(argv[i], "--cpu") && i + 1 < argc)
+        {
+            // pin the event loop to a core
+            int64_t cpu = 0;
+            if (!str2int(argv[++i], cpu) || cpu < 0 || cpu >= CPU_SETSIZE)
+            {
+                fprintf(stderr, "bad cpu: %s\n", argv[i]);
+                return 1;
+            }
+            g_busy.cpu = (int)cpu;
+        }
+        else if (0 == strcmp(argv[i], "--tinylfu"))
+        {
+            // admission by frequency, for the cache mode
+            g_data.admission = true;
+        }
+        else
+        {
+            fprintf(stderr, "unknown option: %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    g_data.ks = ks_new(engine);
+    if (!g_data.ks)
+    {
+        fprintf(stderr, "unknown engine: %s\n", engine);
+        return 1;
+    }
+
+    // victims are sampled from the hashtable buckets
+    if (g_data.evict_policy != EVICT_NONE && !ks_n_slots(g_data.ks))
+    {
+        fprintf(stderr, "eviction requires a hashtable engine\n");
+        return 1;
+    }
+
+    if (g_data.admission)
+    {
+        if (g_data.evict_policy == EVICT_NONE || !g_data.maxmemory)
+        {
+            fprintf(stderr, "--tinylfu requires maxmemory and an eviction policy\n");
+            return 1;
+        }
+
+        // a counter per ~128 bytes of keys, 1/64 of maxmemory
+        size_t width = std::max<size_t>(g_data.maxmemory / 128, 1024);
+        tlfu_init(&g_data.tlfu, std::min<size_t>(width, 1 << 24));
+    }
+
+    hp_pool_init(&g_data.entry_pool, sizeof(Entry));
+
+    // deleted entries and drained bucket arrays are freed through epochs
+    hm_set_retire(&epoch_retire);
+
+    if (g_busy.cpu >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(g_busy.cpu, &set);
+
+        if (sched_setaffinity(0, sizeof(set), &set))
+        {
+            die("sched_setaffinity()");
+        }
+    }
+
+    int fd = listen_on(1234);
+    int admin_fd = g_conns.admin_port ? listen_on(g_conns.admin_port) : -1;
+
+    // a map of all client connections, keyed by fd
+    std::vector<Conn *> fd2conn;
+    tw_init(&g_conns.timers, get_monotonic_msec());
+
     // the event loop
     std::vector<struct pollfd> poll_args;
 
@@ -634,28 +2541,43 @@ int main()
     {
         // prepare the arguments of the poll()
         poll_args.clear();
+        size_t n_admin = 0; // the priority lane, after the listening fd
 
         // for convenience, the listening fd is put in the first position
         struct pollfd pfd = {fd, POLLIN, 0};
         poll_args.push_back(pfd);
 
-        // connection fds
-        for (Conn *conn : fd2conn)
+        // then the priority lane: the admin listening fd and connections,
+        // then the other connections
+        if (admin_fd >= 0)
+        {
+            struct pollfd pfd = {admin_fd, POLLIN, 0};
+            poll_args.push_back(pfd);
+        }
+
+        for (bool admin : {true, false})
         {
-            if (!conn)
+            for (Conn *conn : fd2conn)
             {
-                continue;
+                if (!conn || conn->admin != admin)
+                {
+                    continue;
+                }
+                struct pollfd pfd = {};
+                pfd.fd = conn->fd;
+                pfd.events = (conn->state == STATE_REQ) ? POLLIN : POLLOUT;
+                pfd.events = pfd.events | POLLERR;
+                poll_args.push_back(pfd);
+            }
+
+            if (admin)
+            {
+                n_admin = poll_args.size() - 1;
             }
-            struct pollfd pfd = {};
-            pfd.fd = conn->fd;
-            pfd.events = (conn->state == STATE_REQ) ? POLLIN : POLLOUT;
-            pfd.events = pfd.events | POLLERR;
-            poll_args.push_back(pfd);
         }
 
-        // poll for active fds
-        // the timeout argument doesn't matter here
-        int rv = poll(poll_args.data(), (nfds_t)poll_args.size(), 1000);
+        // poll for active fds, until the next timer
+        int rv = poll_wait(poll_args, next_timeout_ms());
 
         if (rv < 0)
         {
@@ -663,29 +2585,62 @@ int main()
         }
 
         // process active connections
-        for (size_t i = 1; i < poll_args.size(); ++i)
+        evict_update_clock();
+        epoch_enter();
+
+        g_conns.poll_usec = get_monotonic_usec();
+        g_conns.max_lag_usec = 0;
+
+        serve_admin(fd2conn, &poll_args[1], n_admin, admin_fd);
+        uint64_t admin_check_usec = get_monotonic_usec();
+
+        for (size_t i = 1 + n_admin; i < poll_args.size(); ++i)
         {
-            if (poll_args[i].revents)
-            {
-                Conn *conn = fd2conn[poll_args[i].fd];
-                connection_io(conn);
+            serve_conn(fd2conn, poll_args[i]);
 
-                if (conn->state == STATE_END)
+            // the priority lane doesn't wait for the whole iteration
+            if (n_admin && get_monotonic_usec() - admin_check_usec >= k_admin_check_usec)
+            {
+                if (poll(&poll_args[1], (nfds_t)n_admin, 0) > 0)
                 {
-                    // client closed normally, or something bad happened.
-                    // destroy this connection
-                    fd2conn[conn->fd] = NULL;
-                    (void)close(conn->fd);
-                    free(conn);
+                    serve_admin(fd2conn, &poll_args[1], n_admin, admin_fd);
                 }
+                admin_check_usec = get_monotonic_usec();
+                g_conns.n_admin_checks++;
             }
         }
 
+        epoch_exit();
+        (void)epoch_collect();
+
+        // close the connections that have been idle for too long, or slow
+        // to read their output
+        (void)tw_advance(&g_conns.timers, get_monotonic_msec(), &fd2conn);
+
+        expire_step();
+        defrag_step();
+
+        // compact the value log, outside of the critical section
+        if (g_data.log_values)
+        {
+            g_data.log_cleaning = log_clean(k_log_target, k_log_clean_max) > 0;
+        }
+
+        // shed load while the last iteration lagged
+        g_conns.lag_usec = g_conns.max_lag_usec;
+        g_conns.shedding = g_conns.shed_lag_usec && g_conns.lag_usec > g_conns.shed_lag_usec;
+
         // try to accept a new connection if the listening fd is active
-        if (poll_args[0].revents)
+        if (poll_args[0].revents && g_conns.shedding)
+        {
+            reject_conn(fd);
+        }
+        else if (poll_args[0].revents)
         {
-            (void)accept_new_conn(fd2conn, fd);
+            (void)accept_new_conn(fd2conn, fd, false);
         }
+
+        g_busy.work_usec += get_monotonic_usec() - g_conns.poll_usec;
     }
 
     return 0;
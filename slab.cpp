@@ -0,0 +1,374 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <atomic>
+#include <mutex>
+#include "hugepage.h"
+#include "slab.h"
+
+const size_t k_class_size[k_slab_classes] = {
+    16, 32, 48, 64, 80, 96, 112, 128, 160, 192, 256, 320, 384, 512, 768, 1024,
+};
+
+const size_t k_cache_max = 32; // free objects per class in a thread cache
+const size_t k_dense_scan = 32; // partial slabs looked at for the densest one
+
+// the header at the start of each slab
+struct Slab
+{
+    Slab *prev = NULL; // the list of slabs with free objects
+    Slab *next = NULL;
+    void *free_list = NULL;
+    uint32_t cls = 0;
+    uint32_t n_objs = 0;
+    uint32_t n_free = 0;   // including the uncarved objects
+    uint32_t n_carved = 0; // objects are carved on demand to not touch every page
+};
+
+const size_t k_slab_header = (sizeof(Slab) + 63) & ~(size_t)63;
+
+struct SlabClass
+{
+    std::mutex lock;
+    Slab *partial = NULL; // slabs with free objects
+    size_t n_slabs = 0;
+    size_t n_free = 0; // free objects in the slabs
+};
+
+static SlabClass g_classes[k_slab_classes];
+static std::atomic<bool> g_release{false};
+static std::atomic<size_t> g_mapped{0};
+
+static size_t class_of(size_t size)
+{
+    if (size <= 128)
+    {
+        return size ? (size - 1) / 16 : 0;
+    }
+
+    size_t cls = 8;
+    while (k_class_size[cls] < size)
+    {
+        cls++;
+    }
+
+    return cls;
+}
+
+// free objects of this thread, given back when the thread exits
+struct ThreadCache
+{
+    void *objs[k_slab_classes][k_cache_max];
+    uint32_t n[k_slab_classes] = {};
+
+    ~ThreadCache();
+};
+
+static thread_local ThreadCache t_cache;
+static thread_local bool t_defrag = false;
+
+static Slab *slab_of(void *ptr)
+{
+    return (Slab *)((uintptr_t)ptr & ~(uintptr_t)(k_slab_size - 1));
+}
+
+static void list_remove(SlabClass *sc, Slab *slab)
+{
+    if (slab->prev)
+    {
+        slab->prev->next = slab->next;
+    }
+    else
+    {
+        sc->partial = slab->next;
+    }
+
+    if (slab->next)
+    {
+        slab->next->prev = slab->prev;
+    }
+
+    slab->prev = slab->next = NULL;
+}
+
+static void list_push(SlabClass *sc, Slab *slab)
+{
+    slab->prev = NULL;
+    slab->next = sc->partial;
+
+    if (sc->partial)
+    {
+        sc->partial->prev = slab;
+    }
+
+    sc->partial = slab;
+}
+
+// aligned, so that an object finds its slab with `slab_of()`
+static Slab *slab_new(size_t cls)
+{
+    void *ptr = map_aligned(k_slab_size, k_slab_size);
+    if (!ptr)
+    {
+        return NULL;
+    }
+
+    Slab *slab = new (ptr) Slab();
+    slab->cls = (uint32_t)cls;
+    slab->n_objs = (uint32_t)((k_slab_size - k_slab_header) / k_class_size[cls]);
+    slab->n_free = slab->n_objs;
+
+    g_mapped += k_slab_size;
+
+    return slab;
+}
+
+static void slab_unmap(Slab *slab)
+{
+    munmap(slab, k_slab_size);
+    g_mapped -= k_slab_size;
+}
+
+// take an object from a slab, the class lock is held
+static void *slab_take(SlabClass *sc, Slab *slab)
+{
+    void *ptr = slab->free_list;
+
+    if (ptr)
+    {
+        slab->free_list = *(void **)ptr;
+    }
+    else
+    {
+        assert(slab->n_carved < slab->n_objs);
+        ptr = (uint8_t *)slab + k_slab_header + slab->n_carved * k_class_size[slab->cls];
+        slab->n_carved++;
+    }
+
+    slab->n_free--;
+    sc->n_free--;
+
+    if (slab->n_free == 0)
+    {
+        list_remove(sc, slab); // full
+    }
+
+    return ptr;
+}
+
+// give an object back to its slab, the class lock is held
+static void slab_put(SlabClass *sc, void *ptr)
+{
+    Slab *slab = slab_of(ptr);
+
+    *(void **)ptr = slab->free_list;
+    slab->free_list = ptr;
+    slab->n_free++;
+    sc->n_free++;
+
+    if (slab->n_free == 1)
+    {
+        list_push(sc, slab); // was full
+    }
+
+    // keep the last one to not remap it on every alloc and free
+    bool last = !slab->prev && !slab->next;
+    if (slab->n_free == slab->n_objs && !last && g_release.load())
+    {
+        list_remove(sc, slab);
+        sc->n_slabs--;
+        sc->n_free -= slab->n_objs;
+        slab_unmap(slab);
+    }
+}
+
+// move half a cache worth of objects into the thread cache
+static bool cache_refill(ThreadCache &tc, size_t cls)
+{
+    SlabClass *sc = &g_classes[cls];
+    std::lock_guard<std::mutex> guard(sc->lock);
+
+    while (tc.n[cls] < k_cache_max / 2)
+    {
+        if (!sc->partial)
+        {
+            Slab *slab = slab_new(cls);
+            if (!slab)
+            {
+                break;
+            }
+
+            list_push(sc, slab);
+            sc->n_slabs++;
+            sc->n_free += slab->n_objs;
+        }
+
+        tc.objs[cls][tc.n[cls]++] = slab_take(sc, sc->partial);
+    }
+
+    return tc.n[cls] > 0;
+}
+
+// give back the oldest `n` objects of the thread cache
+static void cache_flush(ThreadCache &tc, size_t cls, uint32_t n)
+{
+    SlabClass *sc = &g_classes[cls];
+    std::lock_guard<std::mutex> guard(sc->lock);
+
+    for (uint32_t i = 0; i < n; ++i)
+    {
+        slab_put(sc, tc.objs[cls][i]);
+    }
+
+    tc.n[cls] -= n;
+    for (uint32_t i = 0; i < tc.n[cls]; ++i)
+    {
+        tc.objs[cls][i] = tc.objs[cls][i + n];
+    }
+}
+
+ThreadCache::~ThreadCache()
+{
+    for (size_t cls = 0; cls < k_slab_classes; ++cls)
+    {
+        if (n[cls])
+        {
+            cache_flush(*this, cls, n[cls]);
+        }
+    }
+}
+
+// take from the partial slab with the fewest free objects
+static void *slab_take_dense(size_t cls)
+{
+    SlabClass *sc = &g_classes[cls];
+    std::lock_guard<std::mutex> guard(sc->lock);
+
+    Slab *best = sc->partial;
+    size_t n = 0;
+
+    for (Slab *slab = sc->partial; slab && n < k_dense_scan; slab = slab->next, ++n)
+    {
+        if (slab->n_free < best->n_free)
+        {
+            best = slab;
+        }
+    }
+
+    if (!best)
+    {
+        if (!(best = slab_new(cls)))
+        {
+            return NULL;
+        }
+
+        list_push(sc, best);
+        sc->n_slabs++;
+        sc->n_free += best->n_objs;
+    }
+
+    return slab_take(sc, best);
+}
+
+void *slab_alloc(size_t size)
+{
+    if (size > k_slab_max_obj)
+    {
+        return malloc(size);
+    }
+
+    size_t cls = class_of(size);
+    ThreadCache &tc = t_cache;
+
+    if (t_defrag)
+    {
+        return slab_take_dense(cls);
+    }
+
+    if (tc.n[cls] == 0 && !cache_refill(tc, cls))
+    {
+        return NULL;
+    }
+
+    return tc.objs[cls][--tc.n[cls]];
+}
+
+void slab_free(void *ptr, size_t size)
+{
+    if (!ptr)
+    {
+        return;
+    }
+
+    if (size > k_slab_max_obj)
+    {
+        return free(ptr);
+    }
+
+    size_t cls = class_of(size);
+    ThreadCache &tc = t_cache;
+    assert(slab_of(ptr)->cls == cls);
+
+    if (t_defrag)
+    {
+        SlabClass *sc = &g_classes[cls];
+        std::lock_guard<std::mutex> guard(sc->lock);
+
+        return slab_put(sc, ptr);
+    }
+
+    if (tc.n[cls] == k_cache_max)
+    {
+        cache_flush(tc, cls, k_cache_max / 2);
+    }
+
+    tc.objs[cls][tc.n[cls]++] = ptr;
+}
+
+void slab_set_release(bool on)
+{
+    g_release = on;
+}
+
+bool slab_is_sparse(void *ptr, size_t size)
+{
+    if (size > k_slab_max_obj)
+    {
+        return false;
+    }
+
+    SlabClass *sc = &g_classes[class_of(size)];
+    Slab *slab = slab_of(ptr);
+    std::lock_guard<std::mutex> guard(sc->lock);
+
+    // used / n_objs < class used / class capacity, without the divisions
+    size_t used = slab->n_objs - slab->n_free;
+    size_t class_used = sc->n_slabs * slab->n_objs - sc->n_free;
+
+    return sc->n_slabs > 1 && used * sc->n_slabs < class_used;
+}
+
+void slab_defrag_mode(bool on)
+{
+    t_defrag = on;
+}
+
+void slab_stats(SlabStats stats[k_slab_classes])
+{
+    for (size_t cls = 0; cls < k_slab_classes; ++cls)
+    {
+        SlabClass *sc = &g_classes[cls];
+        std::lock_guard<std::mutex> guard(sc->lock);
+
+        SlabStats &st = stats[cls];
+        st.obj_size = k_class_size[cls];
+        st.n_slabs = sc->n_slabs;
+        st.capacity = sc->n_slabs * ((k_slab_size - k_slab_header) / k_class_size[cls]);
+        st.n_used = st.capacity - sc->n_free;
+    }
+}
+
+size_t slab_mapped_bytes()
+{
+    return g_mapped.load();
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <new>
+#include <string>
+
+// A size-class slab allocator for small objects.
+//
+// Objects of a class are carved from 64 KiB slabs that are aligned to
+// their size, so the slab of an object is found by masking its address.
+// Each thread caches a few free objects per class, the slabs are shared
+// under a per-class lock. Sizes above the largest class go to malloc.
+
+const size_t k_slab_size = 64 * 1024;
+const size_t k_slab_classes = 16;
+const size_t k_slab_max_obj = 1024; // the largest class
+
+struct SlabStats
+{
+    size_t obj_size = 0;
+    size_t n_slabs = 0;
+    size_t n_used = 0; // objects given out, the thread caches count as used
+    size_t capacity = 0;
+};
+
+void *slab_alloc(size_t size);
+
+// `size` must be the size that was allocated
+void slab_free(void *ptr, size_t size);
+
+// unmap slabs as soon as all of their objects are free
+void slab_set_release(bool on);
+
+// Active defragmentation moves objects out of sparse slabs so those can
+// be released. True if the slab of the object is used below the average
+// of its class.
+bool slab_is_sparse(void *ptr, size_t size);
+
+// While on, this thread allocates from the densest slabs and frees
+// straight to the slabs, bypassing its cache.
+void slab_defrag_mode(bool on);
+
+// one entry per size class
+void slab_stats(SlabStats stats[k_slab_classes]);
+
+size_t slab_mapped_bytes();
+
+// for the standard containers
+template <typename T>
+struct SlabAllocator
+{
+    typedef T value_type;
+
+    SlabAllocator() = default;
+
+    template <typename U>
+    SlabAllocator(const SlabAllocator<U> &)
+    {
+    }
+
+    T *allocate(size_t n)
+    {
+        void *ptr = slab_alloc(n * sizeof(T));
+        if (!ptr)
+        {
+            throw std::bad_alloc();
+        }
+        return (T *)ptr;
+    }
+
+    void deallocate(T *ptr, size_t n)
+    {
+        slab_free(ptr, n * sizeof(T));
+    }
+
+    template <typename U>
+    bool operator==(const SlabAllocator<U> &) const
+    {
+        return true;
+    }
+
+    template <typename U>
+    bool operator!=(const SlabAllocator<U> &) const
+    {
+        return false;
+    }
+};
+
+// a string whose heap buffer comes from the slabs
+typedef std::basic_string<char, std::char_traits<char>, SlabAllocator<char>> SlabString;
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "hashtable.h"
+
+// A header-only variant of the HMap interface.
+//
+// `T` is the payload that embeds the `HNode` as the member `Node`,
+// `KeyOf` returns the key of a payload and `Eq` compares two keys.
+// Unlike `hm_lookup()` and `hm_pop()`, which call the `eq` function
+// pointer on every chain step, both policies are known at compile time,
+// so the compare is inlined into the chain walk.
+//
+// The storage is a plain `HMap`, so insertion and progressive resizing
+// are shared with the C-style interface in hashtable.cpp.
+template <typename T, HNode T::*Node, typename KeyOf, typename Eq>
+struct THMap
+{
+    HMap map;
+
+    // the payload that owns the node, like `container_of()`
+    static T *owner(HNode *node)
+    {
+        size_t offset = (size_t)&(((T *)0)->*Node);
+        return (T *)((char *)node - offset);
+    }
+
+    // same as `h_lookup()`, returns the parent pointer of the target node
+    template <typename K>
+    static HNode **h_lookup(HTab *h_tab, const K &key, uint64_t h_code,
+                            uint64_t *n_probes)
+    {
+        if (!h_tab->tab)
+        {
+            return NULL;
+        }
+
+        HNode **from = &h_tab->tab[h_code & h_tab->mask];
+
+        for (HNode *cur; (cur = *from) != NULL; from = &cur->next)
+        {
+            (*n_probes)++;
+
+            if (cur->h_code == h_code && Eq()(KeyOf()(*owner(cur)), key))
+            {
+                return from;
+            }
+        }
+
+        return NULL;
+    }
+
+    static HNode *h_detach(HTab *h_tab, HNode **from)
+    {
+        HNode *node = *from;
+        *from = node->next;
+        h_tab->size--;
+
+        return node;
+    }
+
+    template <typename K>
+    T *lookup(const K &key, uint64_t h_code)
+    {
+        hm_help_resizing(&map);
+        map.n_lookups++;
+
+        HNode **from = h_lookup(&map.h1, key, h_code, &map.n_probes);
+        if (!from && (from = h_lookup(&map.h2, key, h_code, &map.n_probes)))
+        {
+            map.n_h2_hits++;
+        }
+
+        return from ? owner(*from) : NULL;
+    }
+
+    // the caller must set `h_code` of the node
+    void insert(T *ent)
+    {
+        hm_insert(&map, &(ent->*Node));
+    }
+
+    template <typename K>
+    T *pop(const K &key, uint64_t h_code)
+    {
+        hm_help_resizing(&map);
+        map.n_lookups++;
+
+        if (HNode **from = h_lookup(&map.h1, key, h_code, &map.n_probes))
+        {
+            return owner(h_detach(&map.h1, from));
+        }
+
+        if (HNode **from = h_lookup(&map.h2, key, h_code, &map.n_probes))
+        {
+            map.n_h2_hits++;
+            return owner(h_detach(&map.h2, from));
+        }
+
+        return NULL;
+    }
+
+    size_t size()
+    {
+        return hm_size(&map);
+    }
+
+    void destroy()
+    {
+        hm_destroy(&map);
+    }
+};
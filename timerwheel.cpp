@@ -0,0 +1,207 @@
+#include <assert.h>
+#include <algorithm>
+#include "timerwheel.h"
+
+const uint64_t k_tw_mask = k_tw_slots - 1;
+const uint64_t k_tw_range = (uint64_t)1 << (k_tw_bits * k_tw_levels);
+
+// circular lists with the slots as the heads
+static void list_init(TimerNode *head)
+{
+    head->prev = head->next = head;
+}
+
+static bool list_empty(TimerNode *head)
+{
+    return head->next == head;
+}
+
+static void list_push(TimerNode *head, TimerNode *node)
+{
+    node->prev = head->prev;
+    node->next = head;
+    head->prev->next = node;
+    head->prev = node;
+}
+
+// move all nodes of `from` to the empty `to`
+static void list_take(TimerNode *to, TimerNode *from)
+{
+    if (list_empty(from))
+    {
+        list_init(to);
+        return;
+    }
+
+    to->next = from->next;
+    to->prev = from->prev;
+    to->next->prev = to;
+    to->prev->next = to;
+    list_init(from);
+}
+
+void tw_init(TimerWheel *tw, uint64_t now)
+{
+    tw->cur = now;
+    tw->n_timers = 0;
+
+    for (size_t lvl = 0; lvl < k_tw_levels; ++lvl)
+    {
+        tw->level_count[lvl] = 0;
+        for (size_t i = 0; i < k_tw_slots; ++i)
+        {
+            list_init(&tw->slots[lvl][i]);
+        }
+    }
+}
+
+// the level is the smallest one whose range covers the delay
+static void tw_insert(TimerWheel *tw, TimerNode *node)
+{
+    uint64_t tick = std::max(node->expire, tw->cur);
+    uint64_t delta = tick - tw->cur;
+
+    if (delta >= k_tw_range)
+    {
+        tick = tw->cur + k_tw_range - 1; // parked, inserted again on cascade
+        delta = k_tw_range - 1;
+    }
+
+    size_t lvl = 0;
+    while (delta >= (uint64_t)1 << (k_tw_bits * (lvl + 1)))
+    {
+        lvl++;
+    }
+
+    size_t idx = (tick >> (k_tw_bits * lvl)) & k_tw_mask;
+    list_push(&tw->slots[lvl][idx], node);
+    node->level = (uint32_t)lvl;
+
+    tw->level_count[lvl]++;
+    tw->n_timers++;
+}
+
+void tw_del(TimerWheel *tw, TimerNode *node)
+{
+    if (!tw_armed(node))
+    {
+        return;
+    }
+
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->prev = node->next = NULL;
+
+    tw->level_count[node->level]--;
+    tw->n_timers--;
+}
+
+void tw_add(TimerWheel *tw, TimerNode *node, uint64_t expire)
+{
+    tw_del(tw, node);
+    node->expire = expire;
+    tw_insert(tw, node);
+}
+
+// move a slot of an upper level to the lower ones
+static void tw_cascade(TimerWheel *tw, size_t lvl, size_t idx)
+{
+    TimerNode head;
+    list_take(&head, &tw->slots[lvl][idx]);
+
+    while (!list_empty(&head))
+    {
+        TimerNode *node = head.next;
+        tw_del(tw, node);
+        tw_insert(tw, node);
+    }
+}
+
+size_t tw_advance(TimerWheel *tw, uint64_t now, void *arg)
+{
+    size_t n_fired = 0;
+
+    while (tw->cur <= now)
+    {
+        if (!tw->n_timers)
+        {
+            tw->cur = now + 1;
+            break;
+        }
+
+        // while the lower levels are empty, only the cascades of the
+        // lowest non-empty one do anything
+        size_t lvl = 0;
+        while (!tw->level_count[lvl])
+        {
+            lvl++;
+        }
+
+        if (lvl > 0)
+        {
+            uint64_t step = (uint64_t)1 << (k_tw_bits * lvl);
+            uint64_t next = (tw->cur + step - 1) & ~(step - 1);
+
+            if (next > now)
+            {
+                tw->cur = now + 1;
+                break;
+            }
+
+            tw->cur = next;
+        }
+
+        // cascade when the lower level wraps around
+        size_t idx = tw->cur & k_tw_mask;
+        for (size_t up = 1; idx == 0 && up < k_tw_levels; ++up)
+        {
+            idx = (tw->cur >> (k_tw_bits * up)) & k_tw_mask;
+            tw_cascade(tw, up, idx);
+        }
+
+        // the callbacks may re-arm, which lands on the next tick at the earliest
+        TimerNode head;
+        list_take(&head, &tw->slots[0][tw->cur & k_tw_mask]);
+        tw->cur++;
+
+        while (!list_empty(&head))
+        {
+            TimerNode *node = head.next;
+            tw_del(tw, node);
+            node->cb(node, arg);
+            n_fired++;
+        }
+    }
+
+    return n_fired;
+}
+
+uint64_t tw_next(TimerWheel *tw)
+{
+    uint64_t next = UINT64_MAX;
+
+    for (size_t lvl = 0; lvl < k_tw_levels; ++lvl)
+    {
+        if (!tw->level_count[lvl])
+        {
+            continue;
+        }
+
+        // the slots of this level are processed on multiples of `step`
+        size_t shift = k_tw_bits * lvl;
+        uint64_t step = (uint64_t)1 << shift;
+        uint64_t first = (tw->cur + step - 1) & ~(step - 1);
+
+        for (uint64_t i = 0; i < k_tw_slots; ++i)
+        {
+            uint64_t tick = first + (i << shift);
+            if (!list_empty(&tw->slots[lvl][(tick >> shift) & k_tw_mask]))
+            {
+                next = std::min(next, tick);
+                break;
+            }
+        }
+    }
+
+    return next;
+}
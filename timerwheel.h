@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A hierarchical timer wheel of millisecond ticks.
+//
+// Four levels of 64 slots, each slot a list of timers. Level 0 holds the
+// timers due in the next 64 ticks, level 1 those in the next 64 * 64
+// ticks, and so on up to 2^24 ticks (4.6 hours); later ones are parked in
+// the last level until they come closer. Adding, removing and re-arming a
+// timer is O(1). A level's slot is moved down ("cascaded") when the lower
+// level wraps around, so every timer is moved at most 3 times.
+
+const size_t k_tw_levels = 4;
+const size_t k_tw_bits = 6;
+const size_t k_tw_slots = (size_t)1 << k_tw_bits;
+
+// embedded in the owner, see `container_of`
+struct TimerNode
+{
+    TimerNode *prev = NULL; // NULL if not armed
+    TimerNode *next = NULL;
+    uint64_t expire = 0;
+    uint32_t level = 0;
+    void (*cb)(TimerNode *node, void *arg) = NULL; // called when it fires
+};
+
+struct TimerWheel
+{
+    uint64_t cur = 0; // the next tick to process
+    size_t n_timers = 0;
+    size_t level_count[k_tw_levels] = {};
+    TimerNode slots[k_tw_levels][k_tw_slots]; // list heads
+};
+
+void tw_init(TimerWheel *tw, uint64_t now);
+
+inline bool tw_armed(TimerNode *node)
+{
+    return node->prev != NULL;
+}
+
+// (re-)arm the timer to fire at `expire`
+void tw_add(TimerWheel *tw, TimerNode *node, uint64_t expire);
+
+void tw_del(TimerWheel *tw, TimerNode *node);
+
+// Fire the timers due at or before `now`, passing `arg` to their callbacks.
+// They are disarmed before the callback, which may re-arm or delete any
+// timer. Returns the number fired.
+size_t tw_advance(TimerWheel *tw, uint64_t now, void *arg);
+
+// the next tick that has work to do, not later than the next expiry;
+// UINT64_MAX if there are no timers
+uint64_t tw_next(TimerWheel *tw);
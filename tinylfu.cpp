@@ -0,0 +1,181 @@
+#include <assert.h>
+#include <algorithm>
+#include "tinylfu.h"
+
+const size_t k_tlfu_max_count = 15;
+
+static uint64_t mix64(uint64_t x)
+{
+    // splitmix64
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+// the counter of a row: the word and the bit offset in it
+static uint64_t &tlfu_counter(TinyLfu *tl, uint64_t h_code, size_t row, size_t &shift)
+{
+    size_t idx = mix64(h_code + row * 0x9e3779b97f4a7c15ull) & tl->mask;
+    size_t words_per_row = (tl->mask + 1) / 16;
+
+    shift = (idx % 16) * 4;
+    return tl->table[row * words_per_row + idx / 16];
+}
+
+void tlfu_init(TinyLfu *tl, size_t width)
+{
+    size_t n = 16;
+    while (n < width)
+    {
+        n *= 2;
+    }
+
+    tl->table.assign(k_tlfu_rows * n / 16, 0);
+    tl->mask = n - 1;
+    tl->n_adds = 0;
+    tl->sample_size = 10 * n;
+}
+
+// halve every counter, the aging that lets old popularity fade
+static void tlfu_reset(TinyLfu *tl)
+{
+    for (uint64_t &word : tl->table)
+    {
+        word = (word >> 1) & 0x7777777777777777ull;
+    }
+
+    tl->n_adds /= 2;
+}
+
+void tlfu_record(TinyLfu *tl, uint64_t h_code)
+{
+    // conservative update: only the smallest counters grow
+    uint32_t min = tlfu_estimate(tl, h_code);
+    if (min == k_tlfu_max_count)
+    {
+        return;
+    }
+
+    for (size_t row = 0; row < k_tlfu_rows; ++row)
+    {
+        size_t shift = 0;
+        uint64_t &word = tlfu_counter(tl, h_code, row, shift);
+
+        if (((word >> shift) & 0xf) == min)
+        {
+            word += 1ull << shift;
+        }
+    }
+
+    if (++tl->n_adds >= tl->sample_size)
+    {
+        tlfu_reset(tl);
+    }
+}
+
+uint32_t tlfu_estimate(TinyLfu *tl, uint64_t h_code)
+{
+    uint32_t min = k_tlfu_max_count;
+
+    for (size_t row = 0; row < k_tlfu_rows; ++row)
+    {
+        size_t shift = 0;
+        uint64_t word = tlfu_counter(tl, h_code, row, shift);
+
+        min = std::min(min, (uint32_t)((word >> shift) & 0xf));
+    }
+
+    return min;
+}
+
+static size_t key_bytes(const std::string &key)
+{
+    return sizeof(std::string) + key.size();
+}
+
+void tlfu_window_push(TinyLfu *tl, Keyspace *ks, const std::string &key)
+{
+    size_t window_cap = std::max<size_t>(1, ks_size(ks) * k_tlfu_window_pct / 100);
+
+    tl->window.push_back(key);
+    tl->window_bytes += key_bytes(key);
+
+    while (tl->window.size() > window_cap)
+    {
+        if (tl->has_candidate)
+        {
+            tl->window_bytes -= key_bytes(tl->candidate);
+        }
+
+        tl->candidate.swap(tl->window.front());
+        tl->has_candidate = true;
+        tl->window.pop_front();
+    }
+}
+
+static uint64_t key_hash(const std::string &key)
+{
+    return str_hash((uint8_t *)key.data(), key.size());
+}
+
+// the best candidate of the pool that still exists
+static bool pool_victim(Keyspace *ks, EvictPool *pool, int policy,
+                        const EvictScope *scope, std::string &victim)
+{
+    // refill once if the stale candidates were all there was
+    for (int fill = 0; fill < 2; ++fill)
+    {
+        evict_pool_fill(pool, ks, policy, scope);
+
+        while (evict_pool_pop(pool, victim))
+        {
+            if (ks_lookup(ks, victim))
+            {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+bool tlfu_pick_victim(TinyLfu *tl, Keyspace *ks, EvictPool *pool, int policy,
+                      const EvictScope *scope, std::string &victim)
+{
+    if (!tl->has_candidate)
+    {
+        return pool_victim(ks, pool, policy, scope, victim);
+    }
+
+    std::string cand;
+    cand.swap(tl->candidate);
+    tl->has_candidate = false;
+    tl->window_bytes -= key_bytes(cand);
+
+    // deleted meanwhile, or not for this policy to evict
+    Entry *ent = ks_lookup(ks, cand);
+    if (!ent || (scope && scope->eligible && !scope->eligible(ent)))
+    {
+        return pool_victim(ks, pool, policy, scope, victim);
+    }
+
+    if (!pool_victim(ks, pool, policy, scope, victim) || victim == cand)
+    {
+        victim.swap(cand);
+        return true;
+    }
+
+    // the candidate moves to the main region only if it is more popular
+    // than the one it replaces
+    if (tlfu_estimate(tl, key_hash(cand)) > tlfu_estimate(tl, key_hash(victim)))
+    {
+        tl->n_admitted++;
+    }
+    else
+    {
+        tl->n_rejected++;
+        victim.swap(cand);
+    }
+
+    return true;
+}
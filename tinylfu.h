@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "evict.h"
+
+// W-TinyLFU admission for the cache mode.
+//
+// A count-min sketch of 4-bit counters estimates the access frequency of
+// any key, resident or not, and is halved periodically so that old
+// popularity fades. New keys enter a small FIFO window. The key pushed
+// out of a full window is the candidate: on the next eviction it competes
+// with the victim of the eviction policy and the less frequent one is
+// evicted, so one-hit wonders can't push out the working set.
+
+const size_t k_tlfu_rows = 4;
+const size_t k_tlfu_window_pct = 1; // of the keys
+
+struct TinyLfu
+{
+    std::vector<uint64_t> table; // 16 counters per word, per row
+    size_t mask = 0;             // counters per row - 1
+    size_t n_adds = 0;
+    size_t sample_size = 0; // additions between halvings
+    std::deque<std::string> window; // at most `k_tlfu_window_pct` of the keys
+    std::string candidate;           // left the window, not contested yet
+    bool has_candidate = false;
+    size_t window_bytes = 0; // of the keys above
+    uint64_t n_admitted = 0; // window keys that beat the victim
+    uint64_t n_rejected = 0;
+};
+
+// `width` counters per row, rounded up to a power of 2
+void tlfu_init(TinyLfu *tl, size_t width);
+
+void tlfu_record(TinyLfu *tl, uint64_t h_code);
+
+uint32_t tlfu_estimate(TinyLfu *tl, uint64_t h_code);
+
+// A new key enters the window. The oldest key of a full window becomes
+// the candidate; a candidate that wasn't contested until then stays.
+void tlfu_window_push(TinyLfu *tl, Keyspace *ks, const std::string &key);
+
+// The key to evict next: the loser of the candidate against the policy's
+// victim, or the policy's victim. False if nothing can be evicted.
+bool tlfu_pick_victim(TinyLfu *tl, Keyspace *ks, EvictPool *pool, int policy,
+                      const EvictScope *scope, std::string &victim);